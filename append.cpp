@@ -0,0 +1,127 @@
+#include "append.h"
+#include "mrf_info.h"
+#include "fileio.h"
+#include <cpl_minixml.h>
+#include <cpl_vsi.h>
+#include <cstring>
+
+using namespace std;
+
+// Replaces a file with a new one, which is complete on disk
+static bool Replace(const char *tmp, const char *name) {
+    if (0 == VSIRename(tmp, name))
+        return true;
+    // Rename doesn't replace on every platform
+    VSIUnlink(name);
+    return 0 == VSIRename(tmp, name);
+}
+
+// The index is replaced before the metadata, an index larger than the metadata says is from an
+// interrupted run. The new metadata is already complete in its temporary file then, which is
+// put in place, since striding the index again would scramble it
+static bool Recover(const char *fname, const MRFInfo &old, const CPLString &mtmp) {
+    RawFile idx;
+    if (!idx.Open(old.idxfname) || idx.Size() <= old.IdxSize())
+        return true;
+    idx.Close();
+    MRFInfo pending;
+    VSIStatBufL st;
+    if (0 == VSIStatL(mtmp, &st) && pending.Parse(mtmp) && pending.levels.empty()) {
+        RawFile nidx;
+        if (nidx.Open(old.idxfname) && nidx.Size() == pending.IdxSize() && Replace(mtmp, fname))
+            return true;
+    }
+    CPLError(CE_Failure, CPLE_AppDefined, "The index of %s is larger than its metadata says, "
+        "from an interrupted append, and can't be repaired", fname);
+    return false;
+}
+
+bool GrowOutput(const char *fname, int axis, int size) {
+    CPLString mtmp(CPLString(fname) + ".tmp");
+    MRFInfo old;
+    if (!old.Parse(fname)) {
+        CPLError(CE_Failure, CPLE_OpenFailed, "%s is not an MRF", fname);
+        return false;
+    }
+    // The overview levels would change size too
+    if (!old.levels.empty()) {
+        CPLError(CE_Failure, CPLE_NotSupported, "Can't grow %s, it has overviews", fname);
+        return false;
+    }
+    if (!Recover(fname, old, mtmp))
+        return false;
+    if (!old.Parse(fname)) {
+        CPLError(CE_Failure, CPLE_OpenFailed, "%s is not an MRF", fname);
+        return false;
+    }
+    int cur = axis == 0 ? old.xsz : axis == 1 ? old.ysz : old.zsz;
+    if (size <= cur)
+        return true;
+
+    MRFInfo grown(old);
+    if (axis == 0) {
+        grown.xsz = size;
+        grown.pcx = (size + grown.pszx - 1) / grown.pszx;
+    }
+    else if (axis == 1) {
+        grown.ysz = size;
+        grown.pcy = (size + grown.pszy - 1) / grown.pszy;
+    }
+    else
+        grown.zsz = size;
+
+    // The new metadata first, complete but not in place
+    CPLXMLNode *root = CPLParseXMLFile(fname);
+    CPLXMLNode *raster = root ? CPLGetXMLNode(root, "=MRF_META.Raster") : nullptr;
+    bool ok = raster && CPLSetXMLValue(raster, axis == 0 ? "Size.#x" : axis == 1 ? "Size.#y" : "Size.#z",
+        CPLOPrintf("%d", size)) && CPLSerializeXMLTreeToFile(root, mtmp);
+    if (root)
+        CPLDestroyXMLNode(root);
+    if (!ok) {
+        CPLError(CE_Failure, CPLE_FileIO, "Can't write %s", mtmp.c_str());
+        return false;
+    }
+
+    RawFile idx, nidx;
+    MappedFile map, nmap;
+    CPLString tmp(old.idxfname + ".tmp");
+    uint64_t isz = min(old.IdxSize(), idx.Open(old.idxfname) ? idx.Size() : 0);
+    if (!nidx.Open(tmp, true) || !nidx.Truncate(0) || !nidx.Truncate(grown.IdxSize())
+        || !nmap.Map(nidx, grown.IdxSize(), true) || (isz && !map.Map(idx, isz)))
+    {
+        CPLError(CE_Failure, CPLE_FileIO, "Can't write %s", tmp.c_str());
+        return false;
+    }
+
+    // Same order in both, only the strides change, missing records stay empty
+    uint64_t nrecs = isz / sizeof(TileIdx);
+    for (int z = 0; z < old.zsz; z++)
+        for (uint64_t ty = 0; ty < old.pcy; ty++)
+            for (uint64_t tx = 0; tx < old.pcx; tx++)
+                for (uint64_t tc = 0; tc < old.pcc; tc++) {
+                    uint64_t from = old.IdxOffset(static_cast<int>(tx), static_cast<int>(ty), z, static_cast<int>(tc));
+                    if (from / sizeof(TileIdx) >= nrecs)
+                        continue;
+                    memcpy(nmap.Data() + grown.IdxOffset(static_cast<int>(tx), static_cast<int>(ty), z, static_cast<int>(tc)),
+                        map.Data() + from, sizeof(TileIdx));
+                }
+
+    ok = nmap.Sync();
+    nmap.Unmap();
+    map.Unmap();
+    ok = nidx.Sync() && ok;
+    nidx.Close();
+    idx.Close();
+    if (!ok || !Replace(tmp, old.idxfname)) {
+        CPLError(CE_Failure, CPLE_FileIO, "Can't replace %s", old.idxfname.c_str());
+        return false;
+    }
+
+    // Then the metadata, which matches the index again
+    if (!Replace(mtmp, fname)) {
+        CPLError(CE_Failure, CPLE_FileIO, "Can't update %s, the index has already been replaced, "
+            "the new metadata is in %s, running the append again puts it in place", fname, mtmp.c_str());
+        return false;
+    }
+    return true;
+}
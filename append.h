@@ -0,0 +1,9 @@
+// Appending input Z slices to an existing output
+// The output grows along the axis the input Z becomes, the index records move to their place in
+// the larger index, the data file doesn't change
+#pragma once
+
+// Sets the size of output axis x, y or z, 0 to 2, to at least size
+// The new metadata and index are written next to the old ones, then the index is renamed and
+// then the metadata. A run interrupted between the two is completed by the next one
+bool GrowOutput(const char *fname, int axis, int size);
@@ -0,0 +1,93 @@
+#include "arena.h"
+#include <cstdlib>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+static const size_t HUGE_PAGE = 2 * 1024 * 1024;
+
+Arena::Arena(bool huge) : huge(huge) {}
+
+Arena::~Arena() {
+    for (auto &it : blocks) {
+#if defined(__linux__)
+        if (it.second.backing != HEAP) {
+            munmap(it.first, it.second.len);
+            continue;
+        }
+#endif
+        free(it.first);
+    }
+}
+
+char *Arena::Get(size_t size) {
+    lock_guard<mutex> lock(mtx);
+    for (auto &it : blocks) {
+        Block &b = it.second;
+        if (!b.used && b.size == size) {
+            b.used = true;
+            return it.first;
+        }
+    }
+
+    Block b = { size, size, HEAP, true };
+    char *p = nullptr;
+#if defined(__linux__)
+    if (huge && size >= HUGE_PAGE / 2) {
+        b.len = (size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        // Explicit huge pages have to be reserved by the administrator
+        void *m = mmap(nullptr, b.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (m != MAP_FAILED) {
+            b.backing = HUGETLB;
+            p = static_cast<char *>(m);
+        }
+        else {
+            // Transparent huge pages need 2 MiB alignment, the extra is trimmed
+            m = mmap(nullptr, b.len + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (m != MAP_FAILED) {
+                char *base = static_cast<char *>(m);
+                char *aligned = reinterpret_cast<char *>(
+                    (reinterpret_cast<uintptr_t>(base) + HUGE_PAGE - 1) & ~(static_cast<uintptr_t>(HUGE_PAGE) - 1));
+                if (aligned > base)
+                    munmap(base, aligned - base);
+                if (aligned + b.len < base + b.len + HUGE_PAGE)
+                    munmap(aligned + b.len, base + b.len + HUGE_PAGE - (aligned + b.len));
+#if defined(MADV_HUGEPAGE)
+                madvise(aligned, b.len, MADV_HUGEPAGE);
+#endif
+                b.backing = THP;
+                p = aligned;
+            }
+        }
+    }
+#endif
+    if (!p) {
+        b.len = size;
+        b.backing = HEAP;
+        p = static_cast<char *>(malloc(size));
+        if (!p)
+            return nullptr;
+    }
+    blocks[p] = b;
+    return p;
+}
+
+void Arena::Release(char *p) {
+    lock_guard<mutex> lock(mtx);
+    auto it = blocks.find(p);
+    if (it != blocks.end())
+        it->second.used = false;
+}
+
+string Arena::Describe() const {
+    lock_guard<mutex> lock(mtx);
+    size_t count[3] = { 0, 0, 0 };
+    for (auto &it : blocks)
+        count[it.second.backing]++;
+    return to_string(count[HUGETLB]) + " with huge pages, " + to_string(count[THP])
+        + " with transparent huge pages, " + to_string(count[HEAP]) + " from the heap";
+}
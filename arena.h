@@ -0,0 +1,40 @@
+// Large buffers, backed by 2 MiB pages when the system allows it
+// Explicit huge pages are tried first, then transparent huge pages, then the heap
+// Released buffers are kept and handed out again for the same size
+// Buffers move between the threads, their pages are placed on the node that touches them first
+#pragma once
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+
+class Arena {
+public:
+    // Without huge, buffers come from the heap
+    explicit Arena(bool huge = true);
+    ~Arena();
+
+    // A buffer of at least size bytes, nullptr if out of memory
+    char *Get(size_t size);
+    // Back to the arena, kept for reuse
+    void Release(char *p);
+
+    // Buffer counts by backing, for the verbose output
+    std::string Describe() const;
+
+private:
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    enum Backing { HEAP, HUGETLB, THP };
+    struct Block {
+        size_t size;            // As requested
+        size_t len;             // Mapped
+        Backing backing;
+        bool used;
+    };
+
+    bool huge;
+    mutable std::mutex mtx;
+    std::map<char *, Block> blocks;
+};
@@ -0,0 +1,178 @@
+#include "bandstats.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+using namespace std;
+
+// One bucket per value of the 8 bit types
+static const int HBUCKETS = 256;
+
+void BandStats::Moments::Merge(const Moments &o) {
+    if (!o.n)
+        return;
+    if (!n) {
+        *this = o;
+        return;
+    }
+    // Chan et al., pairwise update of the mean and the squared differences
+    uint64_t t = n + o.n;
+    double d = o.mean - mean;
+    mean += d * static_cast<double>(o.n) / static_cast<double>(t);
+    m2 += o.m2 + d * d * (static_cast<double>(n) * static_cast<double>(o.n) / static_cast<double>(t));
+    n = t;
+    min = std::min(min, o.min);
+    max = std::max(max, o.max);
+}
+
+template<typename T> static inline T Load(const char *p) {
+    T v;
+    memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+// Always false for integers, the compiler drops the test
+template<typename T> static inline bool IsNaN(T v) {
+    return v != v;
+}
+
+// Reduces a region row by row, skipping NoData and NaN values
+// Each row is in cache, so it is read twice, for the mean and then for the squared differences
+// Integer sums are exact, the inner loops vectorize when the pixels are contiguous
+template<typename T> static void Reduce(const char *p, int w, int h, GSpacing pix, GSpacing line,
+    int bHasNoData, double nd, BandStats::Moments &m, GUIntBig *hist)
+{
+    typedef typename conditional<is_integral<T>::value && sizeof(T) <= 4, int64_t, double>::type Acc;
+    // A NoData value that doesn't fit the type never matches
+    bool skip = bHasNoData && !std::isnan(nd)
+        && nd >= static_cast<double>(numeric_limits<T>::lowest()) && nd <= static_cast<double>(numeric_limits<T>::max())
+        && static_cast<double>(static_cast<T>(nd)) == nd;
+    T ndv = skip ? static_cast<T>(nd) : T(0);
+    int hbase = static_cast<int>(numeric_limits<T>::lowest());
+
+    for (int y = 0; y < h; y++) {
+        const char *row = p + y * line;
+        uint64_t n = 0;
+        Acc sum = 0;
+        T mn = numeric_limits<T>::max(), mx = numeric_limits<T>::lowest();
+        for (int x = 0; x < w; x++) {
+            T v = Load<T>(row + x * pix);
+            if (IsNaN(v) || (skip && v == ndv))
+                continue;
+            n++;
+            sum += v;
+            mn = std::min(mn, v);
+            mx = std::max(mx, v);
+        }
+        if (!n)
+            continue;
+
+        double mean = static_cast<double>(sum) / static_cast<double>(n);
+        double m2 = 0;
+        for (int x = 0; x < w; x++) {
+            T v = Load<T>(row + x * pix);
+            if (IsNaN(v) || (skip && v == ndv))
+                continue;
+            double d = static_cast<double>(v) - mean;
+            m2 += d * d;
+        }
+        if (hist) {
+            for (int x = 0; x < w; x++) {
+                T v = Load<T>(row + x * pix);
+                if (!(skip && v == ndv))
+                    hist[static_cast<int>(v) - hbase]++;
+            }
+        }
+
+        BandStats::Moments r = { n, static_cast<double>(mn), static_cast<double>(mx), mean, m2 };
+        m.Merge(r);
+    }
+}
+
+BandStats::BandStats() : nbands(0), dt(GDT_Unknown), bHasNoData(0), nd(0), hist(false) {}
+
+bool BandStats::Supported(GDALDataType dt) {
+    switch (dt) {
+    case GDT_Byte:
+    case GDT_UInt16:
+    case GDT_Int16:
+    case GDT_UInt32:
+    case GDT_Int32:
+    case GDT_Float32:
+    case GDT_Float64:
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 5, 0)
+    case GDT_UInt64:
+    case GDT_Int64:
+#endif
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 7, 0)
+    case GDT_Int8:
+#endif
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool BandStats::HistogramSupported(GDALDataType dt) {
+    return Supported(dt) && GDALGetDataTypeSizeBytes(dt) == 1;
+}
+
+void BandStats::Init(int nslices, int nb, GDALDataType type, int hasnd, double ndv, bool h) {
+    nbands = nb;
+    dt = type;
+    bHasNoData = hasnd;
+    nd = ndv;
+    hist = h && HistogramSupported(dt);
+    Moments empty = { 0, numeric_limits<double>::infinity(), -numeric_limits<double>::infinity(), 0, 0 };
+    moments.assign(static_cast<size_t>(nslices) * nbands, empty);
+    histograms.assign(hist ? moments.size() * HBUCKETS : 0, 0);
+}
+
+void BandStats::Add(int z, int c, const char *p, int w, int h, GSpacing pix, GSpacing line) {
+    Moments &m = At(z, c);
+    GUIntBig *hp = hist ? &histograms[(static_cast<size_t>(z) * nbands + c) * HBUCKETS] : nullptr;
+    switch (dt) {
+    case GDT_Byte: Reduce<uint8_t>(p, w, h, pix, line, bHasNoData, nd, m, hp); break;
+    case GDT_UInt16: Reduce<uint16_t>(p, w, h, pix, line, bHasNoData, nd, m, hp); break;
+    case GDT_Int16: Reduce<int16_t>(p, w, h, pix, line, bHasNoData, nd, m, hp); break;
+    case GDT_UInt32: Reduce<uint32_t>(p, w, h, pix, line, bHasNoData, nd, m, hp); break;
+    case GDT_Int32: Reduce<int32_t>(p, w, h, pix, line, bHasNoData, nd, m, hp); break;
+    case GDT_Float32: Reduce<float>(p, w, h, pix, line, bHasNoData, nd, m, hp); break;
+    case GDT_Float64: Reduce<double>(p, w, h, pix, line, bHasNoData, nd, m, hp); break;
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 5, 0)
+    case GDT_UInt64: Reduce<uint64_t>(p, w, h, pix, line, bHasNoData, nd, m, hp); break;
+    case GDT_Int64: Reduce<int64_t>(p, w, h, pix, line, bHasNoData, nd, m, hp); break;
+#endif
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 7, 0)
+    case GDT_Int8: Reduce<int8_t>(p, w, h, pix, line, bHasNoData, nd, m, hp); break;
+#endif
+    default: break;
+    }
+}
+
+void BandStats::AddConstant(int z, int c, double v, uint64_t n) {
+    Moments r = { n, v, v, v, 0 };
+    At(z, c).Merge(r);
+    if (hist) {
+        double lo = GDALDataTypeIsSigned(dt) ? -128 : 0;
+        histograms[(static_cast<size_t>(z) * nbands + c) * HBUCKETS + static_cast<size_t>(v - lo)] += n;
+    }
+}
+
+void BandStats::Apply(int z, GDALDatasetH h) const {
+    // Same as GDAL, the population standard deviation
+    for (int c = 0; c < nbands; c++) {
+        const Moments &m = moments[static_cast<size_t>(z) * nbands + c];
+        if (!m.n)
+            continue; // All NoData
+        GDALRasterBandH b = GDALGetRasterBand(h, c + 1);
+        GDALSetRasterStatistics(b, m.min, m.max, m.mean, sqrt(m.m2 / static_cast<double>(m.n)));
+        if (hist) {
+            double lo = GDALDataTypeIsSigned(dt) ? -128.5 : -0.5;
+            GDALSetDefaultHistogramEx(b, lo, lo + HBUCKETS, HBUCKETS,
+                const_cast<GUIntBig *>(&histograms[(static_cast<size_t>(z) * nbands + c) * HBUCKETS]));
+        }
+    }
+}
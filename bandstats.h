@@ -0,0 +1,47 @@
+// Exact statistics for every output slice and band, accumulated from the transposed cublocks
+// Each region is reduced on its own, then merged, so the totals don't depend on the cublock size
+// Different slices can be added from different threads, the same slice can't
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <gdal.h>
+
+class BandStats {
+public:
+    BandStats();
+
+    // Complex types have no statistics
+    static bool Supported(GDALDataType dt);
+    // Histograms are kept for 8 bit types, one bucket per value
+    static bool HistogramSupported(GDALDataType dt);
+
+    void Init(int nslices, int nbands, GDALDataType dt, int bHasNoData, double nd, bool hist);
+    bool IsActive() const { return !moments.empty(); }
+
+    // Adds a w by h region of band c of slice z, strides in bytes
+    void Add(int z, int c, const char *p, int w, int h, GSpacing pix, GSpacing line);
+    // Adds n pixels of value v, for regions that are not read
+    void AddConstant(int z, int c, double v, uint64_t n);
+
+    // Sets the statistics of every band of slice z on the open slice dataset
+    void Apply(int z, GDALDatasetH h) const;
+
+    // Count, range, mean and the sum of the squared differences from the mean
+    struct Moments {
+        uint64_t n;
+        double min, max, mean, m2;
+        void Merge(const Moments &other);
+    };
+
+private:
+    Moments &At(int z, int c) { return moments[static_cast<size_t>(z) * nbands + c]; }
+
+    int nbands;
+    GDALDataType dt;
+    int bHasNoData;
+    double nd;
+    bool hist;
+    std::vector<Moments> moments;
+    // 256 buckets per slice and band
+    std::vector<GUIntBig> histograms;
+};
@@ -0,0 +1,134 @@
+// Generates a synthetic 3D MRF, used as input for the benchmarks
+// Values are a deterministic function of the position, a smooth ramp with some noise added,
+// so the output of a transpose can be checked and the compression ratio is realistic
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+#include <gdal.h>
+#include <cpl_string.h>
+
+using namespace std;
+
+int Usage(const char *message = nullptr, int retcode = 1) {
+    if (message)
+        cerr << message << endl;
+
+    cerr << "mrf_gen3d writes a synthetic 3rD MRF" << endl
+        << "Usage:" << endl
+        << "mrf_gen3d [-x XSize] [-y YSize] [-z ZSize] [-c Bands] [-ot Type] [-p PageSize] [-n Noise] [-co NAME=VALUE]... out.mrf"
+        << endl << endl
+        << "\t-x, -y, -z : Cube size, defaults to 1024 by 1024 by 256" << endl
+        << "\t-c Bands : Band count, default 1" << endl
+        << "\t-ot Type : GDAL data type, default Byte" << endl
+        << "\t-p PageSize : Square page size, default 512" << endl
+        << "\t-n Noise : Noise fraction of the value range, 0 to 1, default 0.1" << endl
+        << "\t-co NAME=VALUE : MRF creation option, COMPRESS, INTERLEAVE, QUALITY ..." << endl;
+
+    return retcode;
+}
+
+// Repeatable pseudo random value in [0, 1)
+static double Hash(uint64_t x, uint64_t y, uint64_t z, uint64_t c) {
+    uint64_t h = x * 0x9E3779B97F4A7C15ULL ^ y * 0xC2B2AE3D27D4EB4FULL
+        ^ z * 0x165667B19E3779F9ULL ^ c * 0x27D4EB2F165667C5ULL;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return static_cast<double>(h >> 11) / static_cast<double>(1ULL << 53);
+}
+
+// Fits all the GDAL types
+static const double RANGE = 200;
+
+int main(int argc, char **argv) {
+    int xsz = 1024, ysz = 1024, zsz = 256, csz = 1;
+    int psz = 512;
+    double noise = 0.1;
+    GDALDataType dt = GDT_Byte;
+    char **copt = nullptr;
+    GDALAllRegister();
+
+    GDALDriverH d_mrf = GDALGetDriverByName("MRF");
+    if (!d_mrf)
+        return Usage("MRF driver not found");
+
+    std::vector<std::string> fnames;
+
+    int nArgc = GDALGeneralCmdLineProcessor(argc, &argv, 0);
+    if (nArgc < 1)
+        exit(-nArgc);
+
+    for (int iArg = 1; iArg < nArgc; iArg++)
+    {
+        bool more = iArg < nArgc - 1;
+        if (EQUAL(argv[iArg], "-x") && more)
+            xsz = atoi(argv[++iArg]);
+        else if (EQUAL(argv[iArg], "-y") && more)
+            ysz = atoi(argv[++iArg]);
+        else if (EQUAL(argv[iArg], "-z") && more)
+            zsz = atoi(argv[++iArg]);
+        else if (EQUAL(argv[iArg], "-c") && more)
+            csz = atoi(argv[++iArg]);
+        else if (EQUAL(argv[iArg], "-p") && more)
+            psz = atoi(argv[++iArg]);
+        else if (EQUAL(argv[iArg], "-n") && more)
+            noise = CPLAtof(argv[++iArg]);
+        else if (EQUAL(argv[iArg], "-ot") && more)
+            dt = GDALGetDataTypeByName(argv[++iArg]);
+        else if (EQUAL(argv[iArg], "-co") && more)
+            copt = CSLAddString(copt, argv[++iArg]);
+        else
+            fnames.push_back(argv[iArg]);
+    }
+
+    if (fnames.size() != 1)
+        return Usage();
+    if (xsz < 1 || ysz < 1 || zsz < 1 || csz < 1 || psz < 1)
+        return Usage("Sizes have to be positive");
+    if (dt == GDT_Unknown)
+        return Usage("Unknown data type");
+
+    copt = CSLSetNameValue(copt, "ZSIZE", CPLOPrintf("%d", zsz));
+    copt = CSLSetNameValue(copt, "BLOCKXSIZE", CPLOPrintf("%d", psz));
+    copt = CSLSetNameValue(copt, "BLOCKYSIZE", CPLOPrintf("%d", psz));
+
+    // One row of pages at a time, all bands
+    vector<double> buffer(static_cast<size_t>(xsz) * psz * csz);
+    GSpacing pix = sizeof(double), line = pix * xsz, band = line * psz;
+    double amp = RANGE * noise;
+    double slope = (RANGE - amp) / (xsz + ysz + zsz);
+
+    int ret = 0;
+    for (int z = 0; z < zsz && !ret; z++) {
+        CPLString DName;
+        DName.Printf("%s:MRF:Z%d", fnames[0].c_str(), z);
+        GDALDatasetH h = GDALCreate(d_mrf, DName.c_str(), xsz, ysz, csz, dt, copt);
+        if (!h) {
+            ret = 2;
+            break;
+        }
+
+        for (int y0 = 0; y0 < ysz && !ret; y0 += psz) {
+            int dy = min(psz, ysz - y0);
+            for (int c = 0; c < csz; c++)
+                for (int y = 0; y < dy; y++) {
+                    double *row = buffer.data() + (static_cast<size_t>(c) * psz + y) * xsz;
+                    // Bands run in opposite directions
+                    double base = (c % 2) ? (RANGE - amp) : 0;
+                    double sign = (c % 2) ? -1 : 1;
+                    for (int x = 0; x < xsz; x++)
+                        row[x] = base + sign * slope * (x + y0 + y + z) + amp * Hash(x, y0 + y, z, c);
+                }
+            if (CE_None != GDALDatasetRasterIOEx(h, GF_Write, 0, y0, xsz, dy, buffer.data(), xsz, dy,
+                GDT_Float64, csz, nullptr, pix, line, band, nullptr))
+                ret = 3;
+        }
+        GDALClose(h);
+    }
+
+    CSLDestroy(copt);
+    return ret;
+}
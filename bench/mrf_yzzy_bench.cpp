@@ -0,0 +1,251 @@
+// Benchmark harness for mrf_yzzy, POSIX only
+// Generates inputs with mrf_gen3d, then runs mrf_yzzy over a sweep of cube shapes, page sizes
+// and thread counts, reporting the throughput and the peak RSS of each run as CSV
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+int Usage(const char *message = nullptr, int retcode = 1) {
+    if (message)
+        cerr << message << endl;
+
+    cerr << "mrf_yzzy_bench measures mrf_yzzy over a range of inputs" << endl
+        << "Usage:" << endl
+        << "mrf_yzzy_bench [-s Shapes] [-p Pages] [-j Threads] [-ot Type] [-co NAME=VALUE]... [-r Runs]"
+        << " [-bin Dir] [-w WorkDir] [-k]" << endl << endl
+        << "\t-s Shapes : Comma separated XxYxZxC cube sizes, default 2048x512x512x1,2048x512x512x3" << endl
+        << "\t-p Pages : Comma separated page sizes, default 256,512" << endl
+        << "\t-j Threads : Comma separated mrf_yzzy -j values, 0 is sequential, default 0,2,4,8" << endl
+        << "\t-ot Type : Input data type, default Byte" << endl
+        << "\t-co NAME=VALUE : Input creation option, passed to mrf_gen3d" << endl
+        << "\t-r Runs : Runs per configuration, default 1" << endl
+        << "\t-bin Dir : Where mrf_yzzy and mrf_gen3d are, defaults to the folder of this program" << endl
+        << "\t-w WorkDir : Scratch folder, default mrf_yzzy_bench.tmp" << endl
+        << "\t-k : Keep the last generated input" << endl
+        << "The CSV report goes to stdout" << endl;
+
+    return retcode;
+}
+
+struct Shape {
+    int x, y, z, c;
+};
+
+static vector<string> Split(const string &s, char sep) {
+    vector<string> result;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, sep))
+        if (!item.empty())
+            result.push_back(item);
+    return result;
+}
+
+static bool ParseShape(const string &s, Shape &shape) {
+    return 4 == sscanf(s.c_str(), "%dx%dx%dx%d", &shape.x, &shape.y, &shape.z, &shape.c)
+        && shape.x > 0 && shape.y > 0 && shape.z > 0 && shape.c > 0;
+}
+
+// Bytes per value, for the throughput
+static int TypeSize(const string &t) {
+    static const struct { const char *name; int size; } types[] = {
+        {"Byte", 1}, {"Int8", 1}, {"Int16", 2}, {"UInt16", 2}, {"Int32", 4}, {"UInt32", 4},
+        {"Float32", 4}, {"Int64", 8}, {"UInt64", 8}, {"Float64", 8},
+        {"CInt16", 4}, {"CInt32", 8}, {"CFloat32", 8}, {"CFloat64", 16}
+    };
+    for (auto &t1 : types)
+        if (0 == strcasecmp(t1.name, t.c_str()))
+            return t1.size;
+    return 0;
+}
+
+// Removes the files in a folder, the folder itself stays
+static void ClearDir(const string &dir) {
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return;
+    while (struct dirent *e = readdir(d)) {
+        string name = dir + "/" + e->d_name;
+        struct stat st;
+        if (0 == stat(name.c_str(), &st) && S_ISREG(st.st_mode))
+            unlink(name.c_str());
+    }
+    closedir(d);
+}
+
+struct RunResult {
+    int status;     // Exit code, -1 if it didn't run or was killed
+    double seconds;
+    double rss_mib; // Peak resident size
+};
+
+// Runs a program with its output discarded, measuring the wall time and the peak RSS
+static RunResult Run(const vector<string> &args) {
+    RunResult r = { -1, 0, 0 };
+    vector<char *> argv;
+    for (auto &a : args)
+        argv.push_back(const_cast<char *>(a.c_str()));
+    argv.push_back(nullptr);
+
+    auto start = chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0)
+        return r;
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int wstatus = 0;
+    struct rusage ru;
+    while (wait4(pid, &wstatus, 0, &ru) < 0)
+        if (errno != EINTR)
+            return r;
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+#if defined(__APPLE__)
+    r.rss_mib = ru.ru_maxrss / 1048576.0; // Bytes
+#else
+    r.rss_mib = ru.ru_maxrss / 1024.0; // KiB
+#endif
+    if (WIFEXITED(wstatus))
+        r.status = WEXITSTATUS(wstatus);
+    return r;
+}
+
+int main(int argc, char **argv) {
+    string shapes("2048x512x512x1,2048x512x512x3");
+    string pages("256,512");
+    string threads("0,2,4,8");
+    string dtype("Byte");
+    string workdir("mrf_yzzy_bench.tmp");
+    string bindir;
+    vector<string> copts;
+    int runs = 1;
+    bool keep = false;
+
+    for (int iArg = 1; iArg < argc; iArg++)
+    {
+        bool more = iArg < argc - 1;
+        if (!strcmp(argv[iArg], "-s") && more)
+            shapes = argv[++iArg];
+        else if (!strcmp(argv[iArg], "-p") && more)
+            pages = argv[++iArg];
+        else if (!strcmp(argv[iArg], "-j") && more)
+            threads = argv[++iArg];
+        else if (!strcmp(argv[iArg], "-ot") && more)
+            dtype = argv[++iArg];
+        else if (!strcmp(argv[iArg], "-co") && more)
+            copts.push_back(argv[++iArg]);
+        else if (!strcmp(argv[iArg], "-r") && more)
+            runs = atoi(argv[++iArg]);
+        else if (!strcmp(argv[iArg], "-bin") && more)
+            bindir = argv[++iArg];
+        else if (!strcmp(argv[iArg], "-w") && more)
+            workdir = argv[++iArg];
+        else if (!strcmp(argv[iArg], "-k"))
+            keep = true;
+        else
+            return Usage();
+    }
+
+    if (bindir.empty()) {
+        string self(argv[0]);
+        size_t pos = self.rfind('/');
+        bindir = (pos == string::npos) ? "." : self.substr(0, pos);
+    }
+    string yzzy = bindir + "/mrf_yzzy";
+    string gen = bindir + "/mrf_gen3d";
+    if (access(yzzy.c_str(), X_OK) || access(gen.c_str(), X_OK))
+        return Usage(("Can't find mrf_yzzy and mrf_gen3d in " + bindir).c_str());
+
+    int dtsz = TypeSize(dtype);
+    if (!dtsz)
+        return Usage("Unknown data type");
+    if (runs < 1)
+        runs = 1;
+
+    vector<Shape> shapelist;
+    for (auto &s : Split(shapes, ',')) {
+        Shape shape;
+        if (!ParseShape(s, shape))
+            return Usage(("Bad shape " + s).c_str());
+        shapelist.push_back(shape);
+    }
+    vector<int> pagelist, threadlist;
+    for (auto &s : Split(pages, ','))
+        pagelist.push_back(atoi(s.c_str()));
+    for (auto &s : Split(threads, ','))
+        threadlist.push_back(atoi(s.c_str()));
+
+    string indir = workdir + "/in", outdir = workdir + "/out";
+    mkdir(workdir.c_str(), 0755);
+    mkdir(indir.c_str(), 0755);
+    mkdir(outdir.c_str(), 0755);
+
+    cout << "x,y,z,c,type,page,threads,run,status,seconds,MB/s,peak_rss_MiB" << endl;
+    int failures = 0;
+    for (auto &shape : shapelist) {
+        for (int page : pagelist) {
+            ClearDir(indir);
+            string input = indir + "/in.mrf";
+            vector<string> args = { gen, "-x", to_string(shape.x), "-y", to_string(shape.y),
+                "-z", to_string(shape.z), "-c", to_string(shape.c), "-p", to_string(page), "-ot", dtype };
+            for (auto &co : copts) {
+                args.push_back("-co");
+                args.push_back(co);
+            }
+            args.push_back(input);
+            RunResult g = Run(args);
+            if (g.status != 0) {
+                cerr << "mrf_gen3d failed for " << shape.x << "x" << shape.y << "x" << shape.z
+                    << "x" << shape.c << ", page " << page << endl;
+                failures++;
+                continue;
+            }
+
+            // Bytes read, the same amount is written
+            double mb = double(shape.x) * shape.y * shape.z * shape.c * dtsz / 1e6;
+            for (int nthreads : threadlist) {
+                for (int run = 0; run < runs; run++) {
+                    ClearDir(outdir);
+                    RunResult r = Run({ yzzy, "-z", to_string(page), "-j", to_string(nthreads),
+                        input, outdir + "/out.mrf" });
+                    if (r.status != 0)
+                        failures++;
+                    cout << shape.x << "," << shape.y << "," << shape.z << "," << shape.c << ","
+                        << dtype << "," << page << "," << nthreads << "," << run << ","
+                        << r.status << "," << r.seconds << ","
+                        << (r.seconds > 0 ? mb / r.seconds : 0) << "," << r.rss_mib << endl;
+                }
+            }
+        }
+    }
+
+    ClearDir(outdir);
+    rmdir(outdir.c_str());
+    if (!keep) {
+        ClearDir(indir);
+        rmdir(indir.c_str());
+        rmdir(workdir.c_str());
+    }
+    return failures ? 2 : 0;
+}
@@ -0,0 +1,172 @@
+#include "drill.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+#include "options.h"
+#include "pipeline.h"
+
+using namespace std;
+
+bool Drill::AddSource(const char *fname, const int axes[4]) {
+    if (!ValidAxes(axes)) {
+        CPLError(CE_Failure, CPLE_IllegalArg, "The axes have to be a permutation of x, y, z and c");
+        return false;
+    }
+
+    unique_ptr<Copy> s(new Copy);
+    MRFReader &r = s->reader;
+    if (!r.Open(fname)) {
+        CPLError(CE_Failure, CPLE_OpenFailed, "Can't open %s as a 3D MRF", fname);
+        return false;
+    }
+    if (!r.IsSupported() || !r.IndexUsable()) {
+        CPLError(CE_Failure, CPLE_NotSupported, "Can't read the tiles of %s, %s", fname, r.Reason());
+        return false;
+    }
+    // Empty tiles read as the first NoData value
+    if (!r.nodata.empty())
+        r.SetFill(atof(r.nodata));
+
+    int fsz[4] = { r.xsz, r.ysz, r.zsz, r.csz };
+    int o[4];
+    for (int i = 0; i < 4; i++) {
+        s->axes[i] = axes[i];
+        s->inv[axes[i]] = i;
+        o[axes[i]] = fsz[i];
+    }
+    s->pe[0] = r.pszx;
+    s->pe[1] = r.pszy;
+    s->pe[2] = 1;
+    s->pe[3] = r.Interleaved() ? r.csz : 1;
+
+    if (sources.empty())
+        copy(o, o + 4, sz);
+    else if (!equal(o, o + 4, sz) || r.dt != DataType()) {
+        CPLError(CE_Failure, CPLE_AppDefined, "%s doesn't hold the same cube as %s", fname,
+            sources[0]->reader.datafname.c_str());
+        return false;
+    }
+    sources.push_back(move(s));
+    return true;
+}
+
+size_t Drill::SeriesBytes() const {
+    return static_cast<size_t>(sz[2]) * sz[3] * GDALGetDataTypeSizeBytes(DataType());
+}
+
+// Every tile is visited once per point, stepping along the original Z and c axes by the page size
+// of the source axes they became. Tiles are read in data file order
+bool Drill::MakePlan(size_t source, const vector<Point> &pts, Plan &plan) const {
+    const Copy &s = *sources[source];
+    const MRFReader &r = s.reader;
+    plan.source = source;
+    plan.tiles.clear();
+    plan.points.clear();
+    plan.bytes = 0;
+
+    unordered_map<uint64_t, uint32_t> index;
+    int zstep = s.pe[s.inv[2]], cstep = s.pe[s.inv[3]];
+    for (size_t i = 0; i < pts.size(); i++) {
+        const Point &p = pts[i];
+        if (p.x < 0 || p.x >= sz[0] || p.y < 0 || p.y >= sz[1]) {
+            CPLError(CE_Failure, CPLE_IllegalArg, "Point %d,%d is outside of the cube", p.x, p.y);
+            return false;
+        }
+        int f[4];
+        f[s.inv[0]] = p.x;
+        f[s.inv[1]] = p.y;
+        for (int z = 0; z < sz[2]; z += zstep) {
+            f[s.inv[2]] = z;
+            for (int c = 0; c < sz[3]; c += cstep) {
+                f[s.inv[3]] = c;
+                TileKey key = { f[0] / s.pe[0], f[1] / s.pe[1], f[2], f[3] / s.pe[3] };
+                uint64_t rec = r.IdxOffset(key.tx, key.ty, key.z, key.tc);
+                auto it = index.find(rec);
+                if (it == index.end()) {
+                    it = index.insert(make_pair(rec, static_cast<uint32_t>(plan.tiles.size()))).first;
+                    plan.tiles.push_back(key);
+                    plan.points.emplace_back();
+                }
+                plan.points[it->second].push_back(static_cast<uint32_t>(i));
+            }
+        }
+    }
+
+    vector<TileIdx> idx(plan.tiles.size());
+    for (size_t t = 0; t < plan.tiles.size(); t++) {
+        const TileKey &k = plan.tiles[t];
+        idx[t] = r.Index(k.tx, k.ty, k.z, k.tc);
+        plan.bytes += idx[t].size;
+    }
+    vector<size_t> order(plan.tiles.size());
+    iota(order.begin(), order.end(), size_t(0));
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) { return idx[a].offset < idx[b].offset; });
+    vector<TileKey> tiles(order.size());
+    vector<vector<uint32_t>> points(order.size());
+    for (size_t t = 0; t < order.size(); t++) {
+        tiles[t] = plan.tiles[order[t]];
+        points[t].swap(plan.points[order[t]]);
+    }
+    plan.tiles.swap(tiles);
+    plan.points.swap(points);
+    return true;
+}
+
+bool Drill::Cheapest(const vector<Point> &pts, Plan &plan) const {
+    for (size_t i = 0; i < sources.size(); i++) {
+        Plan p;
+        if (!MakePlan(i, pts, p))
+            return false;
+        if (i == 0 || p.bytes < plan.bytes || (p.bytes == plan.bytes && p.tiles.size() < plan.tiles.size()))
+            plan = move(p);
+    }
+    return !sources.empty();
+}
+
+CPLErr Drill::Read(const Plan &plan, const vector<Point> &pts, char *out, int nthreads) const {
+    const Copy &s = *sources[plan.source];
+    const MRFReader &r = s.reader;
+    int fsz[4] = { r.xsz, r.ysz, r.zsz, r.csz };
+    size_t sbytes = SeriesBytes();
+    int dtsz = r.dtsz;
+    nthreads = max(1, nthreads);
+
+    // Copies the samples of the points that fall in a tile
+    auto extract = [&](const TileKey &key, const vector<uint32_t> &users, const char *page) {
+        int st[4] = { key.tx * s.pe[0], key.ty * s.pe[1], key.z, key.tc * s.pe[3] };
+        int end[4];
+        for (int i = 0; i < 4; i++)
+            end[i] = min(st[i] + s.pe[i], fsz[i]);
+        int iz = s.inv[2], ic = s.inv[3];
+        for (uint32_t i : users) {
+            int f[4];
+            f[s.inv[0]] = pts[i].x;
+            f[s.inv[1]] = pts[i].y;
+            char *series = out + i * sbytes;
+            for (f[iz] = st[iz]; f[iz] < end[iz]; f[iz]++)
+                for (f[ic] = st[ic]; f[ic] < end[ic]; f[ic]++) {
+                    size_t off = ((static_cast<size_t>(f[1] - st[1]) * r.pszx + (f[0] - st[0])) * s.pe[3]
+                        + (f[3] - st[3])) * dtsz;
+                    int z = f[s.inv[2]], c = f[s.inv[3]];
+                    memcpy(series + (static_cast<size_t>(z) * sz[3] + c) * dtsz, page + off, dtsz);
+                }
+        }
+    };
+
+    // A few chunks per thread, each one keeps the reader queue full
+    int nchunks = static_cast<int>(min(plan.tiles.size(), static_cast<size_t>(nthreads) * 4));
+    atomic<int> failed(0);
+    ParallelFor(nchunks, nthreads, [&](int k) {
+        size_t t0 = plan.tiles.size() * k / nchunks, t1 = plan.tiles.size() * (k + 1) / nchunks;
+        vector<TileKey> tiles(plan.tiles.begin() + t0, plan.tiles.begin() + t1);
+        CPLErr err = r.ReadTiles(tiles, [&](size_t j, const char *page) {
+            extract(tiles[j], plan.points[t0 + j], page);
+        });
+        if (err != CE_None)
+            failed = 1;
+    });
+    return failed ? CE_Failure : CE_None;
+}
@@ -0,0 +1,55 @@
+// Full Z series of single pixels, for all bands, from a 3D MRF or from transposed copies of it
+// The points are grouped by the tiles they need, each tile is read once, in parallel
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <gdal.h>
+#include "mrf_reader.h"
+
+class Drill {
+public:
+    // A pixel of the original cube
+    struct Point {
+        int x, y;
+    };
+
+    // The tiles of one source needed for a set of points, and the points in each tile
+    struct Plan {
+        size_t source;
+        std::vector<TileKey> tiles;
+        std::vector<std::vector<uint32_t>> points;
+        uint64_t bytes;             // Read from the data file
+    };
+
+    // Adds a copy of the cube, axes are the original x, y, z and c axes that became its x, y, z and c,
+    // numbered 0 to 3, same as --axes. All the copies have to hold the same cube
+    bool AddSource(const char *fname, const int axes[4]);
+    size_t Sources() const { return sources.size(); }
+    const MRFReader &Input(size_t i) const { return sources[i]->reader; }
+
+    // Original size, x, y, z and c
+    int Size(int axis) const { return sz[axis]; }
+    GDALDataType DataType() const { return sources.empty() ? GDT_Unknown : sources[0]->reader.dt; }
+    // Bytes of the series of one point, [z][c]
+    size_t SeriesBytes() const;
+
+    // Tiles a source needs, false if a point is outside of the cube
+    bool MakePlan(size_t source, const std::vector<Point> &pts, Plan &plan) const;
+    // The source that reads the fewest bytes, then the fewest tiles
+    bool Cheapest(const std::vector<Point> &pts, Plan &plan) const;
+
+    // Reads the series of the points, out holds SeriesBytes() for each
+    CPLErr Read(const Plan &plan, const std::vector<Point> &pts, char *out, int nthreads) const;
+
+private:
+    struct Copy {
+        MRFReader reader;
+        int axes[4];
+        int inv[4];                 // Source axis of each original axis
+        int pe[4];                  // Page size along the source axes
+    };
+
+    std::vector<std::unique_ptr<Copy>> sources;
+    int sz[4];
+};
@@ -0,0 +1,355 @@
+#include "fileio.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(HAVE_LIBURING)
+#include <cerrno>
+#include <liburing.h>
+#endif
+
+#if defined(_WIN32)
+
+RawFile::RawFile() : h(INVALID_HANDLE_VALUE) {}
+
+bool RawFile::Open(const char *name, bool update) {
+    Close();
+    h = CreateFileA(name, update ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+        update ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    return IsOpen();
+}
+
+void RawFile::Close() {
+    if (IsOpen())
+        CloseHandle(h);
+    h = INVALID_HANDLE_VALUE;
+}
+
+bool RawFile::IsOpen() const {
+    return h != INVALID_HANDLE_VALUE;
+}
+
+// Windows I/O is chunked, sizes are DWORD
+int64_t RawFile::PRead(void *buf, size_t size, uint64_t offset) const {
+    int64_t done = 0;
+    while (size) {
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD chunk = static_cast<DWORD>(size < 0x40000000 ? size : 0x40000000), got = 0;
+        if (!ReadFile(h, buf, chunk, &got, &ov))
+            return GetLastError() == ERROR_HANDLE_EOF ? done : -1;
+        if (!got)
+            break;
+        done += got;
+        size -= got;
+        offset += got;
+        buf = static_cast<char *>(buf) + got;
+    }
+    return done;
+}
+
+int64_t RawFile::PWrite(const void *buf, size_t size, uint64_t offset) const {
+    int64_t done = 0;
+    while (size) {
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD chunk = static_cast<DWORD>(size < 0x40000000 ? size : 0x40000000), put = 0;
+        if (!WriteFile(h, buf, chunk, &put, &ov))
+            return -1;
+        done += put;
+        size -= put;
+        offset += put;
+        buf = static_cast<const char *>(buf) + put;
+    }
+    return done;
+}
+
+uint64_t RawFile::Size() const {
+    LARGE_INTEGER s;
+    if (!GetFileSizeEx(h, &s))
+        return 0;
+    return static_cast<uint64_t>(s.QuadPart);
+}
+
+bool RawFile::Truncate(uint64_t size) const {
+    FILE_END_OF_FILE_INFO info;
+    info.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+    return 0 != SetFileInformationByHandle(h, FileEndOfFileInfo, &info, sizeof(info));
+}
+
+bool RawFile::Sync() const {
+    return 0 != FlushFileBuffers(h);
+}
+
+MappedFile::MappedFile() : ptr(nullptr), sz(0), hmap(nullptr) {}
+
+bool MappedFile::Map(const RawFile &file, uint64_t size, bool update) {
+    Unmap();
+    if (!size)
+        return false;
+    hmap = CreateFileMappingA(file.Handle(), NULL, update ? PAGE_READWRITE : PAGE_READONLY,
+        static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), NULL);
+    if (!hmap)
+        return false;
+    ptr = static_cast<char *>(MapViewOfFile(hmap, update ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(size)));
+    if (!ptr) {
+        CloseHandle(hmap);
+        hmap = nullptr;
+        return false;
+    }
+    sz = size;
+    return true;
+}
+
+void MappedFile::Unmap() {
+    if (ptr)
+        UnmapViewOfFile(ptr);
+    if (hmap)
+        CloseHandle(hmap);
+    ptr = nullptr;
+    hmap = nullptr;
+    sz = 0;
+}
+
+bool MappedFile::Sync() const {
+    return !ptr || 0 != FlushViewOfFile(ptr, 0);
+}
+
+#else
+
+RawFile::RawFile() : fd(-1) {}
+
+bool RawFile::Open(const char *name, bool update) {
+    Close();
+    fd = update ? open(name, O_RDWR | O_CREAT, 0666) : open(name, O_RDONLY);
+    return IsOpen();
+}
+
+void RawFile::Close() {
+    if (IsOpen())
+        close(fd);
+    fd = -1;
+}
+
+bool RawFile::IsOpen() const {
+    return fd >= 0;
+}
+
+int64_t RawFile::PRead(void *buf, size_t size, uint64_t offset) const {
+    int64_t done = 0;
+    while (size) {
+        ssize_t got = pread(fd, buf, size, static_cast<off_t>(offset));
+        if (got < 0)
+            return -1;
+        if (!got)
+            break;
+        done += got;
+        size -= got;
+        offset += got;
+        buf = static_cast<char *>(buf) + got;
+    }
+    return done;
+}
+
+int64_t RawFile::PWrite(const void *buf, size_t size, uint64_t offset) const {
+    int64_t done = 0;
+    while (size) {
+        ssize_t put = pwrite(fd, buf, size, static_cast<off_t>(offset));
+        if (put < 0)
+            return -1;
+        done += put;
+        size -= put;
+        offset += put;
+        buf = static_cast<const char *>(buf) + put;
+    }
+    return done;
+}
+
+uint64_t RawFile::Size() const {
+    struct stat st;
+    if (fstat(fd, &st))
+        return 0;
+    return static_cast<uint64_t>(st.st_size);
+}
+
+bool RawFile::Truncate(uint64_t size) const {
+    return 0 == ftruncate(fd, static_cast<off_t>(size));
+}
+
+bool RawFile::Sync() const {
+    return 0 == fsync(fd);
+}
+
+MappedFile::MappedFile() : ptr(nullptr), sz(0) {}
+
+bool MappedFile::Map(const RawFile &file, uint64_t size, bool update) {
+    Unmap();
+    if (!size)
+        return false;
+    void *p = mmap(nullptr, static_cast<size_t>(size), update ? (PROT_READ | PROT_WRITE) : PROT_READ,
+        MAP_SHARED, file.Handle(), 0);
+    if (p == MAP_FAILED)
+        return false;
+    ptr = static_cast<char *>(p);
+    sz = size;
+    return true;
+}
+
+void MappedFile::Unmap() {
+    if (ptr)
+        munmap(ptr, static_cast<size_t>(sz));
+    ptr = nullptr;
+    sz = 0;
+}
+
+bool MappedFile::Sync() const {
+    return !ptr || 0 == msync(ptr, static_cast<size_t>(sz), MS_SYNC);
+}
+
+#endif
+
+RawFile::~RawFile() {
+    Close();
+}
+
+MappedFile::~MappedFile() {
+    Unmap();
+}
+
+struct ReadQueue::Request {
+    const RawFile *file;
+    char *buf;
+    size_t size;
+    uint64_t offset;
+    uint64_t tag;
+};
+
+ReadQueue::ReadQueue() : ring(nullptr), depth(0), entries(0), pending(0), unsubmitted(0), failed(false) {}
+
+ReadQueue::~ReadQueue() {
+    uint64_t tag;
+    int64_t got;
+    // Buffers in flight belong to the caller, wait for them
+    while (pending && Pop(tag, got))
+        ;
+    Reset();
+}
+
+void ReadQueue::Reset() {
+#if defined(HAVE_LIBURING)
+    if (ring) {
+        io_uring_queue_exit(static_cast<io_uring *>(ring));
+        delete static_cast<io_uring *>(ring);
+        ring = nullptr;
+    }
+#endif
+    for (Request *req : inflight)
+        delete req;
+    inflight.clear();
+    done.clear();
+    pending = 0;
+    unsubmitted = 0;
+    failed = false;
+}
+
+void ReadQueue::Init(unsigned d) {
+    depth = d ? d : 1;
+#if defined(HAVE_LIBURING)
+    // A deeper queue needs a larger ring, the reads in flight have to be popped before
+    if (ring && depth > entries && !pending) {
+        io_uring_queue_exit(static_cast<io_uring *>(ring));
+        delete static_cast<io_uring *>(ring);
+        ring = nullptr;
+    }
+    // Containers and old kernels may not allow io_uring, reads are synchronous then
+    if (!ring) {
+        io_uring *r = new io_uring;
+        if (io_uring_queue_init(depth, r, 0) < 0)
+            delete r;
+        else {
+            ring = r;
+            entries = depth;
+        }
+    }
+#endif
+}
+
+bool ReadQueue::Push(const RawFile &file, void *buf, size_t size, uint64_t offset, uint64_t tag) {
+    if (pending >= depth || failed)
+        return false;
+#if defined(HAVE_LIBURING)
+    if (ring) {
+        io_uring *r = static_cast<io_uring *>(ring);
+        io_uring_sqe *sqe = io_uring_get_sqe(r);
+        if (!sqe)
+            return false;
+        Request *req = new Request{ &file, static_cast<char *>(buf), size, offset, tag };
+        inflight.insert(req);
+        io_uring_prep_read(sqe, file.Handle(), buf, static_cast<unsigned>(size), offset);
+        io_uring_sqe_set_data(sqe, req);
+        pending++;
+        unsubmitted++;
+        return true;
+    }
+#endif
+    done.emplace_back(tag, file.PRead(buf, size, offset));
+    pending++;
+    return true;
+}
+
+bool ReadQueue::Pop(uint64_t &tag, int64_t &got) {
+    if (!pending || failed)
+        return false;
+#if defined(HAVE_LIBURING)
+    if (ring) {
+        io_uring *r = static_cast<io_uring *>(ring);
+        // Submitted in batches, one system call for all the reads queued since the last pop
+        if (unsubmitted) {
+            if (io_uring_submit(r) < 0) {
+                failed = true;
+                return false;
+            }
+            unsubmitted = 0;
+        }
+        io_uring_cqe *cqe = nullptr;
+        int err;
+        while ((err = io_uring_wait_cqe(r, &cqe)) == -EINTR)
+            ;
+        if (err < 0) {
+            failed = true;
+            return false;
+        }
+        Request *req = static_cast<Request *>(io_uring_cqe_get_data(cqe));
+        int res = cqe->res;
+        io_uring_cqe_seen(r, cqe);
+        pending--;
+        tag = req->tag;
+        // Short reads are finished here, failures are retried the same way, which also covers
+        // kernels without the read opcode
+        if (res < 0)
+            res = 0;
+        got = res;
+        if (static_cast<size_t>(res) < req->size) {
+            int64_t rest = req->file->PRead(req->buf + res, req->size - res, req->offset + res);
+            got = rest < 0 ? -1 : res + rest;
+        }
+        inflight.erase(req);
+        delete req;
+        return true;
+    }
+#endif
+    tag = done.front().first;
+    got = done.front().second;
+    done.pop_front();
+    pending--;
+    return true;
+}
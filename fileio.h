@@ -0,0 +1,108 @@
+// Positional file access and file mappings, safe to share between threads
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_set>
+#include <utility>
+
+class RawFile {
+public:
+    RawFile();
+    ~RawFile();
+
+    // Opens for reading, or for read-write when update is set, creating the file if needed
+    bool Open(const char *name, bool update = false);
+    void Close();
+    bool IsOpen() const;
+
+    // Return the number of bytes transferred, -1 on error
+    int64_t PRead(void *buf, size_t size, uint64_t offset) const;
+    int64_t PWrite(const void *buf, size_t size, uint64_t offset) const;
+
+    uint64_t Size() const;
+    bool Truncate(uint64_t size) const;
+    bool Sync() const;
+
+#if defined(_WIN32)
+    void *Handle() const { return h; }
+#else
+    int Handle() const { return fd; }
+#endif
+
+private:
+    RawFile(const RawFile &) = delete;
+    RawFile &operator=(const RawFile &) = delete;
+#if defined(_WIN32)
+    void *h;
+#else
+    int fd;
+#endif
+};
+
+// Maps the first size bytes of an open file
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool Map(const RawFile &file, uint64_t size, bool update = false);
+    void Unmap();
+    // Flushes the modified pages of an update mapping to the file
+    bool Sync() const;
+
+    char *Data() const { return ptr; }
+    uint64_t Size() const { return sz; }
+
+private:
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    char *ptr;
+    uint64_t sz;
+#if defined(_WIN32)
+    void *hmap;
+#endif
+};
+
+// Positional reads kept in flight, up to the queue depth, completing in any order
+// Uses io_uring when built with HAVE_LIBURING and the kernel allows it, otherwise
+// each read is done when pushed. Not thread safe, use one per thread
+class ReadQueue {
+public:
+    ReadQueue();
+    ~ReadQueue();
+
+    // Sets the depth, the most reads pushed and not yet popped
+    // Growing it needs all the reads popped first
+    void Init(unsigned depth);
+    unsigned Depth() const { return depth; }
+    // Whether reads are asynchronous
+    bool IsAsync() const { return ring != nullptr; }
+
+    // Queues a read, the buffer has to stay valid until it is popped
+    bool Push(const RawFile &file, void *buf, size_t size, uint64_t offset, uint64_t tag);
+    // Waits for a read to complete, got is the number of bytes read, -1 on error
+    // False when nothing is pending, or when the ring failed, reads are still pending then
+    bool Pop(uint64_t &tag, int64_t &got);
+    size_t Pending() const { return pending; }
+    // Whether the ring failed, only Reset clears it
+    bool Failed() const { return failed; }
+    // Drops the reads in flight and the ring, so the kernel doesn't own their buffers any more
+    // Init sets up a new ring
+    void Reset();
+
+private:
+    ReadQueue(const ReadQueue &) = delete;
+    ReadQueue &operator=(const ReadQueue &) = delete;
+    struct Request;
+    void *ring;
+    unsigned depth;
+    unsigned entries;           // Ring size
+    size_t pending;
+    unsigned unsubmitted;
+    bool failed;
+    // Asynchronous reads not popped yet
+    std::unordered_set<Request *> inflight;
+    // Completed synchronous reads
+    std::deque<std::pair<uint64_t, int64_t>> done;
+};
@@ -0,0 +1,65 @@
+#include "journal.h"
+#include <cstring>
+#include <cstdlib>
+
+using namespace std;
+
+static const char *SIGNATURE = "mrf_yzzy journal 1";
+
+Journal::Journal() : f(nullptr), done(0) {}
+
+Journal::~Journal() {
+    Close();
+}
+
+// Previous progress, 0 if there is none or it doesn't match
+static size_t ReadBack(const char *fname, const string &geometry) {
+    FILE *in = fopen(fname, "r");
+    if (!in)
+        return 0;
+    size_t n = 0;
+    char line[1024];
+    if (fgets(line, sizeof(line), in) && 0 == strncmp(line, SIGNATURE, strlen(SIGNATURE))
+        && fgets(line, sizeof(line), in) && geometry + "\n" == line)
+    {
+        unsigned long long v;
+        while (fgets(line, sizeof(line), in))
+            if (strchr(line, '\n') && 1 == sscanf(line, "done %llu", &v))
+                n = static_cast<size_t>(v);
+    }
+    fclose(in);
+    return n;
+}
+
+bool Journal::Open(const char *fname, const string &geometry, bool resume) {
+    Close();
+    name = fname;
+    done = resume ? ReadBack(fname, geometry) : 0;
+    if (done) {
+        f = fopen(fname, "a");
+        // Ends a torn last line
+        return f && fputs("\n", f) >= 0 && 0 == fflush(f);
+    }
+
+    f = fopen(fname, "w");
+    if (!f)
+        return false;
+    fprintf(f, "%s\n%s\n", SIGNATURE, geometry.c_str());
+    return 0 == fflush(f);
+}
+
+void Journal::Close(bool finished) {
+    if (!f)
+        return;
+    fclose(f);
+    f = nullptr;
+    if (finished)
+        remove(name.c_str());
+}
+
+bool Journal::Mark(size_t n) {
+    if (!f)
+        return false;
+    fprintf(f, "done %llu\n", static_cast<unsigned long long>(n));
+    return 0 == fflush(f);
+}
@@ -0,0 +1,32 @@
+// Progress journal, so an interrupted transpose can resume
+// Cublocks are written in sequence, so the progress is the count of completed cublocks
+// Each mark is appended as a line, a torn last line is ignored when reading back
+#pragma once
+#include <cstdio>
+#include <cstddef>
+#include <string>
+
+class Journal {
+public:
+    Journal();
+    ~Journal();
+
+    // Opens or creates the journal, geometry identifies the run
+    // With resume, the previous progress is kept if the geometry is the same
+    bool Open(const char *fname, const std::string &geometry, bool resume);
+    // Removes the journal when finished
+    void Close(bool finished = false);
+
+    // Completed cublocks when opened
+    size_t Done() const { return done; }
+
+    // The first n cublocks are in the output
+    bool Mark(size_t n);
+
+private:
+    Journal(const Journal &) = delete;
+    Journal &operator=(const Journal &) = delete;
+    std::string name;
+    FILE *f;
+    size_t done;
+};
@@ -0,0 +1,186 @@
+#include "merge.h"
+#include "mrf_info.h"
+#include "fileio.h"
+#include <iostream>
+#include <algorithm>
+#include <cpl_conv.h>
+#include <cpl_minixml.h>
+
+using namespace std;
+
+// Data file copy size
+static const size_t CHUNK = 64 * 1024 * 1024;
+
+static bool SameGeometry(const MRFInfo &a, const MRFInfo &b) {
+    return a.xsz == b.xsz && a.ysz == b.ysz && a.zsz == b.zsz && a.csz == b.csz
+        && a.pszx == b.pszx && a.pszy == b.pszy && a.pszc == b.pszc && a.dt == b.dt
+        && EQUAL(a.compression, b.compression) && a.netbyteorder == b.netbyteorder && a.scale == b.scale;
+}
+
+// The metadata of a part, without explicit data and index file names, so they follow the target
+static bool WriteMetadata(const char *target, const char *part) {
+    CPLXMLNode *root = CPLParseXMLFile(part);
+    if (!root)
+        return false;
+    CPLXMLNode *raster = CPLGetXMLNode(root, "=MRF_META.Raster");
+    if (raster) {
+        for (const char *name : { "DataFile", "IndexFile" }) {
+            CPLXMLNode *node = CPLGetXMLNode(raster, name);
+            if (node) {
+                CPLRemoveXMLChild(raster, node);
+                CPLDestroyXMLNode(node);
+            }
+        }
+    }
+    bool ok = raster && CPLSerializeXMLTreeToFile(root, target);
+    CPLDestroyXMLNode(root);
+    return ok;
+}
+
+// Appends a whole file at offset
+static bool CopyData(const RawFile &dst, uint64_t offset, const RawFile &src, vector<char> &buffer) {
+    uint64_t size = src.Size();
+    for (uint64_t pos = 0; pos < size; pos += buffer.size()) {
+        size_t n = static_cast<size_t>(min(static_cast<uint64_t>(buffer.size()), size - pos));
+        if (src.PRead(buffer.data(), n, pos) != static_cast<int64_t>(n)
+            || dst.PWrite(buffer.data(), n, offset + pos) != static_cast<int64_t>(n))
+            return false;
+    }
+    return true;
+}
+
+// Statistics and histograms are kept per slice and band, outside of the MRF metadata
+static void CopySliceStats(const char *target, const char *part, int z) {
+    CPLString SName, DName;
+    SName.Printf("%s:MRF:Z%d", part, z);
+    DName.Printf("%s:MRF:Z%d", target, z);
+    GDALDatasetH hs = GDALOpen(SName, GA_ReadOnly);
+    if (!hs)
+        return;
+    GDALDatasetH hd = nullptr;
+    for (int c = 1; c <= GDALGetRasterCount(hs); c++) {
+        GDALRasterBandH bs = GDALGetRasterBand(hs, c);
+        double min_v, max_v, mean_v, stdd_v;
+        bool hasstats = CE_None == GDALGetRasterStatistics(bs, FALSE, FALSE, &min_v, &max_v, &mean_v, &stdd_v);
+        double lo, hi;
+        int nbuckets = 0;
+        GUIntBig *histogram = nullptr;
+        bool hashist = CE_None == GDALGetDefaultHistogramEx(bs, &lo, &hi, &nbuckets, &histogram, FALSE, nullptr,
+            nullptr);
+        if ((hasstats || hashist) && !hd)
+            hd = GDALOpen(DName, GA_Update);
+        if (hd) {
+            GDALRasterBandH bd = GDALGetRasterBand(hd, c);
+            if (hasstats)
+                GDALSetRasterStatistics(bd, min_v, max_v, mean_v, stdd_v);
+            if (hashist)
+                GDALSetDefaultHistogramEx(bd, lo, hi, nbuckets, histogram);
+        }
+        CPLFree(histogram);
+    }
+    if (hd)
+        GDALClose(hd);
+    GDALClose(hs);
+}
+
+int MergeParts(const char *target, const vector<string> &parts, bool verbose) {
+    vector<MRFInfo> info(parts.size());
+    for (size_t i = 0; i < parts.size(); i++) {
+        if (!info[i].Parse(parts[i].c_str())) {
+            CPLError(CE_Failure, CPLE_OpenFailed, "%s is not an MRF", parts[i].c_str());
+            return 2;
+        }
+        if (!SameGeometry(info[0], info[i])) {
+            CPLError(CE_Failure, CPLE_AppDefined, "%s doesn't match %s", parts[i].c_str(), parts[0].c_str());
+            return 2;
+        }
+    }
+
+    MRFInfo out;
+    RawFile data, idx;
+    MappedFile idxmap;
+    if (!WriteMetadata(target, parts[0].c_str()) || !out.Parse(target)) {
+        CPLError(CE_Failure, CPLE_FileIO, "Can't write %s", target);
+        return 5;
+    }
+    // Starts empty, missing index records are empty tiles
+    // Overview records are rebased the same way
+    if (!data.Open(out.datafname, true) || !idx.Open(out.idxfname, true)
+        || !data.Truncate(0) || !idx.Truncate(0) || !idx.Truncate(out.IdxTotalSize())
+        || !idxmap.Map(idx, out.IdxTotalSize(), true))
+    {
+        CPLError(CE_Failure, CPLE_FileIO, "Can't write %s", out.datafname.c_str());
+        return 5;
+    }
+
+    // The part that wrote each slice
+    vector<int> owner(out.zsz, -1);
+    uint64_t dataend = 0;
+    vector<char> buffer(CHUNK);
+    for (size_t i = 0; i < parts.size(); i++) {
+        const MRFInfo &in = info[i];
+        RawFile pdata, pidx;
+        MappedFile pmap;
+        if (!pdata.Open(in.datafname) || !pidx.Open(in.idxfname)) {
+            CPLError(CE_Failure, CPLE_OpenFailed, "Can't open %s", in.datafname.c_str());
+            return 2;
+        }
+
+        // The index can be short, when the last slices were not written
+        uint64_t nrecs = min(pidx.Size(), in.IdxTotalSize()) / sizeof(TileIdx);
+        uint64_t dsz = pdata.Size();
+        uint64_t ntiles = 0;
+        if (nrecs && !pmap.Map(pidx, nrecs * sizeof(TileIdx))) {
+            CPLError(CE_Failure, CPLE_FileIO, "Can't map %s", in.idxfname.c_str());
+            return 2;
+        }
+        for (uint64_t r = 0; r < nrecs; r++) {
+            const char *rec = pmap.Data() + r * sizeof(TileIdx);
+            uint64_t size = GetBE64(rec + sizeof(uint64_t));
+            if (!size)
+                continue;
+            uint64_t offset = GetBE64(rec);
+            int z = out.RecordSlice(r);
+            char *orec = idxmap.Data() + r * sizeof(TileIdx);
+            if (offset + size > dsz) {
+                CPLError(CE_Failure, CPLE_AppDefined, "%s is incomplete, slice %d", parts[i].c_str(), z);
+                return 2;
+            }
+            if (GetBE64(orec + sizeof(uint64_t))) {
+                CPLError(CE_Failure, CPLE_AppDefined, "%s and %s overlap at slice %d",
+                    parts[owner[z]].c_str(), parts[i].c_str(), z);
+                return 2;
+            }
+            PutBE64(orec, dataend + offset);
+            PutBE64(orec + sizeof(uint64_t), size);
+            owner[z] = static_cast<int>(i);
+            ntiles++;
+        }
+
+        // The whole data file, in one sequential pass
+        if (ntiles) {
+            if (!CopyData(data, dataend, pdata, buffer)) {
+                CPLError(CE_Failure, CPLE_FileIO, "Can't copy %s to %s", in.datafname.c_str(), out.datafname.c_str());
+                return 5;
+            }
+            dataend += dsz;
+        }
+        if (verbose)
+            cout << parts[i] << ": " << ntiles << " tiles, " << dsz << " bytes" << endl;
+    }
+
+    bool ok = idxmap.Sync();
+    idxmap.Unmap();
+    ok = data.Sync() && idx.Sync() && ok;
+    data.Close();
+    idx.Close();
+    if (!ok) {
+        CPLError(CE_Failure, CPLE_FileIO, "Can't write %s", target);
+        return 5;
+    }
+
+    for (int z = 0; z < out.zsz; z++)
+        if (owner[z] >= 0)
+            CopySliceStats(target, parts[owner[z]].c_str(), z);
+    return 0;
+}
@@ -0,0 +1,8 @@
+// Joins the outputs of partial runs, each one holding a different range of output slices
+// The tiles are copied as they are, only the index offsets change
+#pragma once
+#include <string>
+#include <vector>
+
+// Returns 0 on success, an exit code otherwise
+int MergeParts(const char *target, const std::vector<std::string> &parts, bool verbose);
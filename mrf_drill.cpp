@@ -0,0 +1,199 @@
+// Extracts the full Z series of pixels from a 3D MRF, or from any of its transposed copies
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gdal.h>
+#include <cpl_conv.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+#include "options.h"
+#include "drill.h"
+
+using namespace std;
+
+static int Usage(const char *message = nullptr, int retcode = 1) {
+    if (message)
+        cerr << message << endl;
+
+    cerr << "mrf_drill reads the full Z series of pixels from a 3D MRF, for all bands" << endl
+        << "Usage:" << endl
+        << "mrf_drill [-j Threads] [-m MiB] [-f csv|bin] [-o out] [-v] [--axes XYZC] cube.mrf [[--axes XYZC] copy.mrf]... points.txt" << endl << endl
+        << "\tpoints.txt : One x y pixel position of the original cube per line, separated by a space or a comma" << endl
+        << "\t--axes XYZC : How the MRF that follows was transposed, same as for mrf_yzzy, the default is xyzc" << endl
+        << "\t\tGiven more than one MRF of the same cube, the one that reads the least is used" << endl
+        << "\t-j Threads : Parallel tile reads, the default is the number of cores" << endl
+        << "\t-m MiB : Memory for the series, points are done in batches that fit" << endl
+        << "\t-f csv : One line per point and Z, with the point number, x, y, z and the bands, the default" << endl
+        << "\t-f bin : The raw values, as [point][z][band] of the data type, in the machine byte order" << endl
+        << "\t-o out : Output file, the default is stdout" << endl
+        << "\t-v : verbose, to stderr" << endl;
+
+    return retcode;
+}
+
+// Blank lines and # comments are skipped, fractional positions are in the pixel they fall in
+static bool ReadPoints(const char *fname, vector<Drill::Point> &pts) {
+    VSILFILE *fp = VSIFOpenL(fname, "rb");
+    if (!fp) {
+        CPLError(CE_Failure, CPLE_OpenFailed, "Can't open %s", fname);
+        return false;
+    }
+    int lineno = 0;
+    bool ok = true;
+    for (const char *line = CPLReadLineL(fp); line; line = CPLReadLineL(fp)) {
+        lineno++;
+        CPLString l(line);
+        l.Trim();
+        if (l.empty() || l[0] == '#')
+            continue;
+        double x, y;
+        if (2 != sscanf(l.c_str(), "%lf%*[ ,\t]%lf", &x, &y)) {
+            CPLError(CE_Failure, CPLE_AppDefined, "Can't read a point from line %d of %s", lineno, fname);
+            ok = false;
+            break;
+        }
+        Drill::Point p = { static_cast<int>(floor(x)), static_cast<int>(floor(y)) };
+        pts.push_back(p);
+    }
+    VSIFCloseL(fp);
+    return ok;
+}
+
+// One line per point and Z
+static void WriteCSV(FILE *f, const Drill &drill, const vector<Drill::Point> &pts, size_t first, size_t count,
+    const char *series)
+{
+    int csz = drill.Size(3), zsz = drill.Size(2);
+    GDALDataType dt = drill.DataType();
+    int dtsz = GDALGetDataTypeSizeBytes(dt);
+    const char *fmt = dt == GDT_Float32 ? ",%.9g" : ",%.17g";
+    vector<double> v(csz);
+    for (size_t i = 0; i < count; i++) {
+        const Drill::Point &p = pts[first + i];
+        for (int z = 0; z < zsz; z++) {
+            GDALCopyWords64(series + (i * zsz + z) * csz * dtsz, dt, dtsz, v.data(), GDT_Float64, sizeof(double), csz);
+            fprintf(f, "%zu,%d,%d,%d", first + i, p.x, p.y, z);
+            for (int c = 0; c < csz; c++)
+                fprintf(f, fmt, v[c]);
+            fprintf(f, "\n");
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    bool verbose = false;
+    bool csv = true;
+    int nthreads = static_cast<int>(thread::hardware_concurrency());
+    size_t budget = static_cast<size_t>(1024) << 20;
+    const char *outname = nullptr;
+    int axes[4] = { 0, 1, 2, 3 };
+    vector<pair<string, vector<int>>> cubes;
+    const char *pointsname = nullptr;
+    GDALAllRegister();
+
+    int nArgc = GDALGeneralCmdLineProcessor(argc, &argv, 0);
+    if (nArgc < 1)
+        exit(-nArgc);
+
+    for (int iArg = 1; iArg < nArgc; iArg++) {
+        if (EQUAL(argv[iArg], "-v"))
+            verbose = true;
+        else if (EQUAL(argv[iArg], "-j") && iArg < nArgc - 1) {
+            if (!ParseCount(argv[++iArg], 1, nthreads))
+                return Usage(CPLOPrintf("Invalid thread count %s", argv[iArg]));
+        }
+        else if (EQUAL(argv[iArg], "-m") && iArg < nArgc - 1) {
+            if (!ParseMiB(argv[++iArg], budget))
+                return Usage(CPLOPrintf("Invalid memory size %s", argv[iArg]));
+        }
+        else if (EQUAL(argv[iArg], "-o") && iArg < nArgc - 1)
+            outname = argv[++iArg];
+        else if (EQUAL(argv[iArg], "-f") && iArg < nArgc - 1) {
+            iArg++;
+            if (!EQUAL(argv[iArg], "csv") && !EQUAL(argv[iArg], "bin"))
+                return Usage(CPLOPrintf("Unknown format %s", argv[iArg]));
+            csv = EQUAL(argv[iArg], "csv");
+        }
+        else if (EQUAL(argv[iArg], "--axes") && iArg < nArgc - 1) {
+            if (!ParseAxes(argv[++iArg], axes))
+                return Usage(CPLOPrintf("Invalid axes %s", argv[iArg]));
+        }
+        else if (argv[iArg][0] == '-' && argv[iArg][1])
+            return Usage(CPLOPrintf("Unknown option %s", argv[iArg]));
+        else {
+            // The last name is the points, the previous ones are MRFs
+            if (pointsname)
+                cubes.push_back(make_pair(string(pointsname), vector<int>(axes, axes + 4)));
+            pointsname = argv[iArg];
+            for (int a = 0; a < 4; a++)
+                axes[a] = a;
+        }
+    }
+    if (cubes.empty() || !pointsname)
+        return Usage();
+    if (nthreads < 1)
+        nthreads = 1;
+
+    Drill drill;
+    for (auto &c : cubes)
+        if (!drill.AddSource(c.first.c_str(), c.second.data()))
+            return 1;
+    if (csv && GDALDataTypeIsComplex(drill.DataType()))
+        return Usage("Complex values can only be written with -f bin");
+
+    vector<Drill::Point> pts;
+    if (!ReadPoints(pointsname, pts))
+        return 1;
+
+    FILE *f = outname ? fopen(outname, "wb") : stdout;
+    if (!f) {
+        CPLError(CE_Failure, CPLE_OpenFailed, "Can't create %s", outname);
+        return 1;
+    }
+    if (csv) {
+        fprintf(f, "point,x,y,z");
+        for (int c = 0; c < drill.Size(3); c++)
+            fprintf(f, ",b%d", c + 1);
+        fprintf(f, "\n");
+    }
+
+    // Points are done in batches, in order, each batch reads the tiles it needs once
+    size_t sbytes = drill.SeriesBytes();
+    size_t batch = max(static_cast<size_t>(1), budget / sbytes);
+    vector<char> series;
+    int ret = 0;
+    for (size_t first = 0; first < pts.size() && !ret; first += batch) {
+        size_t count = min(batch, pts.size() - first);
+        vector<Drill::Point> part(pts.begin() + first, pts.begin() + first + count);
+        Drill::Plan plan;
+        if (!drill.Cheapest(part, plan)) {
+            ret = 1;
+            break;
+        }
+        if (verbose)
+            cerr << "Points " << first << " to " << first + count - 1 << ", reading " << plan.tiles.size()
+                << " tiles, " << plan.bytes << " bytes from " << drill.Input(plan.source).datafname << endl;
+        series.resize(count * sbytes);
+        if (CE_None != drill.Read(plan, part, series.data(), nthreads)) {
+            ret = 1;
+            break;
+        }
+        if (csv)
+            WriteCSV(f, drill, pts, first, count, series.data());
+        else if (fwrite(series.data(), 1, series.size(), f) != series.size()) {
+            CPLError(CE_Failure, CPLE_FileIO, "Can't write the output");
+            ret = 1;
+        }
+    }
+
+    if (outname && fclose(f))
+        ret = 1;
+    else if (!outname)
+        fflush(stdout);
+    return ret;
+}
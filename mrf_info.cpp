@@ -0,0 +1,109 @@
+#include "mrf_info.h"
+#include <cpl_minixml.h>
+
+using namespace std;
+
+// Default data file extensions, from the MRF driver
+static const char *DataExtension(const char *comp) {
+    if (EQUAL(comp, "NONE"))
+        return "til";
+    if (EQUAL(comp, "DEFLATE"))
+        return "pzp";
+    if (EQUAL(comp, "JPEG"))
+        return "pjg";
+    if (EQUAL(comp, "JPNG"))
+        return "pjp";
+    if (EQUAL(comp, "TIF"))
+        return "ptf";
+    if (EQUAL(comp, "LERC"))
+        return "lrc";
+    if (EQUAL(comp, "ZSTD"))
+        return "pzs";
+    if (EQUAL(comp, "QB3"))
+        return "pq3";
+    return "ppg"; // PNG and PPNG
+}
+
+// File names in the MRF are relative to the MRF itself
+static CPLString FileName(const char *mrfname, const char *name, const char *ext) {
+    if (!name || !*name)
+        return CPLResetExtension(mrfname, ext);
+    if (CPLIsFilenameRelative(name) && *CPLGetPath(mrfname))
+        return CPLFormFilename(CPLGetPath(mrfname), name, nullptr);
+    return name;
+}
+
+MRFInfo::MRFInfo() : xsz(0), ysz(0), zsz(0), csz(0), pszx(0), pszy(0), pszc(0),
+    dt(GDT_Byte), dtsz(1), netbyteorder(false), pcx(0), pcy(0), pcc(0), scale(0)
+{}
+
+// Same as the MRF driver, each level is a fraction of the previous one, rounded up
+vector<MRFInfo::Level> MRFInfo::Levels(int xsz, int ysz, int zsz, int csz, int pszx, int pszy, int pszc, int scale) {
+    vector<Level> levels;
+    uint64_t pcx = (xsz + pszx - 1) / pszx, pcy = (ysz + pszy - 1) / pszy, pcc = csz / pszc;
+    uint64_t offset = 0;
+    while (scale > 1 && pcx * pcy != 1) {
+        offset += pcc * pcx * pcy * zsz * sizeof(TileIdx);
+        xsz = (xsz - 1) / scale + 1;
+        ysz = (ysz - 1) / scale + 1;
+        pcx = (xsz + pszx - 1) / pszx;
+        pcy = (ysz + pszy - 1) / pszy;
+        Level l = { xsz, ysz, pcx, pcy, offset };
+        levels.push_back(l);
+    }
+    return levels;
+}
+
+int MRFInfo::RecordSlice(uint64_t rec) const {
+    uint64_t pos = rec * sizeof(TileIdx);
+    uint64_t offset = 0, slice = pcc * pcx * pcy;
+    for (const Level &l : levels) {
+        if (pos < l.idxoffset)
+            break;
+        offset = l.idxoffset;
+        slice = pcc * l.pcx * l.pcy;
+    }
+    return static_cast<int>((pos - offset) / sizeof(TileIdx) / slice);
+}
+
+bool MRFInfo::Parse(const char *fname) {
+    CPLXMLNode *root = CPLParseXMLFile(fname);
+    if (!root)
+        return false;
+
+    CPLXMLNode *meta = CPLGetXMLNode(root, "=MRF_META");
+    if (!meta) {
+        CPLDestroyXMLNode(root);
+        return false;
+    }
+
+    xsz = atoi(CPLGetXMLValue(meta, "Raster.Size.x", "0"));
+    ysz = atoi(CPLGetXMLValue(meta, "Raster.Size.y", "0"));
+    zsz = atoi(CPLGetXMLValue(meta, "Raster.Size.z", "1"));
+    csz = atoi(CPLGetXMLValue(meta, "Raster.Size.c", "1"));
+    pszx = atoi(CPLGetXMLValue(meta, "Raster.PageSize.x", "512"));
+    pszy = atoi(CPLGetXMLValue(meta, "Raster.PageSize.y", "512"));
+    pszc = atoi(CPLGetXMLValue(meta, "Raster.PageSize.c", "1"));
+    compression = CPLGetXMLValue(meta, "Raster.Compression", "PNG");
+    dt = GDALGetDataTypeByName(CPLGetXMLValue(meta, "Raster.DataType", "Byte"));
+    dtsz = GDALGetDataTypeSizeBytes(dt);
+    netbyteorder = CPLTestBool(CPLGetXMLValue(meta, "Raster.NetByteOrder", "FALSE"));
+    datafname = FileName(fname, CPLGetXMLValue(meta, "Raster.DataFile", nullptr), DataExtension(compression));
+    idxfname = FileName(fname, CPLGetXMLValue(meta, "Raster.IndexFile", nullptr), "idx");
+    options = CPLGetXMLValue(meta, "Options", "");
+    nodata = CPLGetXMLValue(meta, "Raster.DataValues.NoData", "");
+    // Only uniform overviews have a fixed index layout
+    if (CPLGetXMLNode(meta, "Rsets") && EQUAL(CPLGetXMLValue(meta, "Rsets.model", "uniform"), "uniform"))
+        scale = atoi(CPLGetXMLValue(meta, "Rsets.scale", "2"));
+    CPLDestroyXMLNode(root);
+
+    if (xsz <= 0 || ysz <= 0 || zsz <= 0 || csz <= 0 || pszx <= 0 || pszy <= 0 || dtsz <= 0
+        || (pszc != 1 && pszc != csz))
+        return false;
+
+    pcx = (xsz + pszx - 1) / pszx;
+    pcy = (ysz + pszy - 1) / pszy;
+    pcc = csz / pszc;
+    levels = Levels(xsz, ysz, zsz, csz, pszx, pszy, pszc, scale);
+    return true;
+}
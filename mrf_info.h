@@ -0,0 +1,87 @@
+// The parts of the MRF metadata file needed to access tiles directly
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <gdal.h>
+#include <cpl_string.h>
+
+// One index record, stored big endian in the file
+struct TileIdx {
+    uint64_t offset;
+    uint64_t size;
+};
+
+inline uint64_t GetBE64(const char *p) {
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(p);
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+        v = (v << 8) | b[i];
+    return v;
+}
+
+inline void PutBE64(char *p, uint64_t v) {
+    for (int i = 7; i >= 0; i--, v >>= 8)
+        p[i] = static_cast<char>(v & 0xff);
+}
+
+struct MRFInfo {
+    MRFInfo();
+
+    // Parses the MRF metadata, false if it isn't one
+    bool Parse(const char *fname);
+
+    size_t PageBytes() const {
+        return static_cast<size_t>(pszx) * pszy * pszc * dtsz;
+    }
+
+    // Same as MRF, one page holds all bands when interleaved
+    bool Interleaved() const { return pszc > 1; }
+
+    // Same order as the MRF driver, band, then x, y and z
+    // Each overview level has its own index, after the previous one
+    uint64_t IdxOffset(int tx, int ty, int z, int tc = 0, int level = 0) const {
+        if (level) {
+            const Level &l = levels[level - 1];
+            return l.idxoffset + (tc + pcc * (tx + l.pcx * (ty + l.pcy * static_cast<uint64_t>(z)))) * sizeof(TileIdx);
+        }
+        return (tc + pcc * (tx + pcx * (ty + pcy * static_cast<uint64_t>(z)))) * sizeof(TileIdx);
+    }
+
+    // Full resolution index size
+    uint64_t IdxSize() const {
+        return pcc * pcx * pcy * zsz * sizeof(TileIdx);
+    }
+
+    // With the overviews
+    uint64_t IdxTotalSize() const {
+        if (levels.empty())
+            return IdxSize();
+        const Level &l = levels.back();
+        return l.idxoffset + pcc * l.pcx * l.pcy * zsz * sizeof(TileIdx);
+    }
+
+    // Output slice of an index record, at any level
+    int RecordSlice(uint64_t rec) const;
+
+    // Uniform scale overview levels, from 1, halving until a single page with the default scale
+    struct Level {
+        int xsz, ysz;
+        uint64_t pcx, pcy;
+        uint64_t idxoffset;
+    };
+    static std::vector<Level> Levels(int xsz, int ysz, int zsz, int csz, int pszx, int pszy, int pszc, int scale);
+
+    int xsz, ysz, zsz, csz;
+    int pszx, pszy, pszc;
+    GDALDataType dt;
+    int dtsz;
+    CPLString compression;
+    CPLString options;          // Free form options
+    CPLString nodata;           // Per band NoData values, empty without
+    bool netbyteorder;
+    CPLString datafname, idxfname;
+    // Tiles per axis
+    uint64_t pcx, pcy, pcc;
+    int scale;                  // Overview scale, 0 without overviews
+    std::vector<Level> levels;
+};
@@ -0,0 +1,232 @@
+#include "mrf_reader.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+MRFReader::MRFReader() : deflate(false), swab(false), v2(false), fill(0), depth(64) {}
+
+bool MRFReader::Open(const char *fname) {
+    Close();
+    if (!Parse(fname))
+        return false;
+    char **opts = CSLTokenizeString2(options, " ", 0);
+    swab = dtsz > 1 && netbyteorder;
+    v2 = CSLFetchNameValue(opts, "V2") != nullptr;
+
+    // Only raw and zlib streams are decoded here, the rest is left to GDAL
+    deflate = EQUAL(compression, "DEFLATE")
+        || (EQUAL(compression, "NONE") && CPLTestBool(CSLFetchNameValue(opts, "DEFLATE") ? CSLFetchNameValue(opts, "DEFLATE") : "NO"));
+    if (!EQUAL(compression, "NONE") && !EQUAL(compression, "DEFLATE"))
+        reason = CPLOPrintf("%s compression", compression.c_str());
+    else if (CSLFetchNameValue(opts, "GZ") || CSLFetchNameValue(opts, "RAWZ") || CSLFetchNameValue(opts, "ZSTD"))
+        reason = "Unsupported DEFLATE stream option";
+    else if (v2)
+        reason = "V2 index";
+    CSLDestroy(opts);
+
+    if (!datafile.Open(datafname) || !idxfile.Open(idxfname)) {
+        Close();
+        return false;
+    }
+
+    // An empty index is a valid empty MRF, leave it unmapped
+    uint64_t idxsize = idxfile.Size();
+    if (idxsize && !idxmap.Map(idxfile, idxsize)) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MRFReader::Close() {
+    idxmap.Unmap();
+    idxfile.Close();
+    datafile.Close();
+    reason.clear();
+}
+
+TileIdx MRFReader::Index(int tx, int ty, int z, int tc) const {
+    TileIdx ti = { 0, 0 };
+    uint64_t pos = IdxOffset(tx, ty, z, tc);
+    if (pos + sizeof(TileIdx) > idxmap.Size())
+        return ti; // Never written
+    ti.offset = GetBE64(idxmap.Data() + pos);
+    ti.size = GetBE64(idxmap.Data() + pos + sizeof(uint64_t));
+    return ti;
+}
+
+CPLErr MRFReader::Decode(const TileKey &key, char *data, size_t size, char *page) const {
+    size_t pbytes = PageBytes();
+    if (!deflate) {
+        if (size != pbytes) {
+            CPLError(CE_Failure, CPLE_FileIO, "Can't read tile %d,%d,%d from %s", key.tx, key.ty, key.z, datafname.c_str());
+            return CE_Failure;
+        }
+        if (data != page)
+            memcpy(page, data, pbytes);
+    }
+    else {
+        size_t outsz = 0;
+        if (!CPLZLibInflate(data, size, page, pbytes, &outsz) || outsz != pbytes) {
+            CPLError(CE_Failure, CPLE_FileIO, "Can't decode tile %d,%d,%d from %s", key.tx, key.ty, key.z, datafname.c_str());
+            return CE_Failure;
+        }
+    }
+
+    // Complex types swap each component
+    if (swab) {
+        int wsz = GDALDataTypeIsComplex(dt) ? dtsz / 2 : dtsz;
+        GDALSwapWords(page, wsz, static_cast<int>(pbytes / wsz), wsz);
+    }
+    return CE_None;
+}
+
+CPLErr MRFReader::ReadTile(int tx, int ty, int z, int tc, void *page, vector<char> &scratch) const {
+    size_t pbytes = PageBytes();
+    TileKey key = { tx, ty, z, tc };
+    TileIdx ti = Index(tx, ty, z, tc);
+
+    if (!ti.size) {
+        GDALCopyWords64(&fill, GDT_Float64, 0, page, dt, dtsz, static_cast<GIntBig>(pbytes / dtsz));
+        return CE_None;
+    }
+
+    // Raw tiles are read in place
+    char *data = static_cast<char *>(page);
+    if (deflate) {
+        scratch.resize(static_cast<size_t>(ti.size));
+        data = scratch.data();
+    }
+    else if (ti.size != pbytes)
+        return Decode(key, data, static_cast<size_t>(ti.size), data);
+    if (datafile.PRead(data, static_cast<size_t>(ti.size), ti.offset) != static_cast<int64_t>(ti.size)) {
+        CPLError(CE_Failure, CPLE_FileIO, "Can't read tile %d,%d,%d from %s", tx, ty, z, datafname.c_str());
+        return CE_Failure;
+    }
+    return Decode(key, data, static_cast<size_t>(ti.size), static_cast<char *>(page));
+}
+
+// Each slot holds one read in flight, a slot is reused once its tile is decoded
+// Empty tiles don't need a read
+CPLErr MRFReader::ReadTiles(const vector<TileKey> &tiles, const function<void(size_t, const char *)> &done) const {
+    thread_local ReadQueue queue;
+    thread_local vector<vector<char>> slots;
+    thread_local vector<char> page;
+    if (queue.Depth() != depth) {
+        uint64_t tag;
+        int64_t got;
+        while (queue.Pop(tag, got))
+            ;
+        if (queue.Failed())
+            queue.Reset();
+        queue.Init(depth);
+    }
+    size_t pbytes = PageBytes();
+    page.resize(pbytes);
+    slots.resize(depth);
+    vector<size_t> owner(depth);
+    vector<unsigned> freeslots;
+    for (unsigned s = depth; s > 0; s--)
+        freeslots.push_back(s - 1);
+
+    CPLErr err = CE_None;
+    size_t next = 0;
+    for (;;) {
+        // Fill the queue
+        while (err == CE_None && next < tiles.size() && !freeslots.empty()) {
+            const TileKey &key = tiles[next];
+            TileIdx ti = Index(key.tx, key.ty, key.z, key.tc);
+            if (!ti.size) {
+                GDALCopyWords64(&fill, GDT_Float64, 0, page.data(), dt, dtsz, static_cast<GIntBig>(pbytes / dtsz));
+                done(next++, page.data());
+                continue;
+            }
+            unsigned s = freeslots.back();
+            slots[s].resize(static_cast<size_t>(ti.size));
+            if (!queue.Push(datafile, slots[s].data(), slots[s].size(), ti.offset, s)) {
+                CPLError(CE_Failure, CPLE_FileIO, "Can't queue reads from %s", datafname.c_str());
+                err = CE_Failure;
+                break;
+            }
+            freeslots.pop_back();
+            owner[s] = next++;
+        }
+
+        // Decode as they complete, in flight reads are waited for even after an error
+        uint64_t tag;
+        int64_t got;
+        if (!queue.Pop(tag, got))
+            break;
+        unsigned s = static_cast<unsigned>(tag);
+        freeslots.push_back(s);
+        if (err != CE_None)
+            continue;
+        const TileKey &key = tiles[owner[s]];
+        vector<char> &data = slots[s];
+        if (got != static_cast<int64_t>(data.size())) {
+            CPLError(CE_Failure, CPLE_FileIO, "Can't read tile %d,%d,%d from %s", key.tx, key.ty, key.z, datafname.c_str());
+            err = CE_Failure;
+            continue;
+        }
+        // Raw tiles are decoded in their slot
+        char *dst = deflate ? page.data() : data.data();
+        err = Decode(key, data.data(), data.size(), dst);
+        if (err == CE_None)
+            done(owner[s], dst);
+    }
+
+    // A failed ring leaves reads pending, and tiles that were never read
+    if (queue.Pending() || next < tiles.size()) {
+        if (err == CE_None)
+            CPLError(CE_Failure, CPLE_FileIO, "Reads from %s didn't complete", datafname.c_str());
+        err = CE_Failure;
+    }
+    if (queue.Failed()) {
+        queue.Reset();
+        queue.Init(depth);
+    }
+    return err;
+}
+
+static int GCD(int a, int b) {
+    return b ? GCD(b, a % b) : a;
+}
+
+int PageUnit(int in, int out, int size) {
+    return min(in / GCD(in, out) * out, size);
+}
+
+CPLErr MRFReader::ReadBlock(const int start[4], const int size[4], char *buf, const GSpacing stride[4]) const {
+    // Bands per tile, interleaved tiles hold all bands and are read once
+    int bpt = Interleaved() ? csz : 1;
+    int ntx = (size[0] + pszx - 1) / pszx;
+    int nty = (size[1] + pszy - 1) / pszy;
+    int ntc = Interleaved() ? 1 : size[3];
+    thread_local vector<TileKey> tiles;
+    tiles.clear();
+    for (int z = 0; z < size[2]; z++)
+        for (int ty = 0; ty < nty; ty++)
+            for (int tx = 0; tx < ntx; tx++)
+                for (int c = 0; c < ntc; c++)
+                    tiles.push_back({ start[0] / pszx + tx, start[1] / pszy + ty, start[2] + z,
+                        Interleaved() ? 0 : start[3] + c });
+
+    return ReadTiles(tiles, [&](size_t i, const char *page) {
+        int c = static_cast<int>(i % ntc);
+        int x0 = static_cast<int>((i / ntc) % ntx) * pszx;
+        int y0 = static_cast<int>((i / ntc / ntx) % nty) * pszy;
+        int z = static_cast<int>(i / ntc / ntx / nty);
+        int w = min(pszx, size[0] - x0);
+        int h = min(pszy, size[1] - y0);
+        // The block bands in this tile
+        int c0 = Interleaved() ? 0 : c, c1 = Interleaved() ? size[3] : c + 1;
+        for (c = c0; c < c1; c++) {
+            int b = Interleaved() ? start[3] + c : 0;
+            char *dst = buf + c * stride[3] + z * stride[2] + y0 * stride[1] + x0 * stride[0];
+            for (int y = 0; y < h; y++)
+                GDALCopyWords64(page + (static_cast<size_t>(y) * pszx * bpt + b) * dtsz, dt, bpt * dtsz,
+                    dst + y * stride[1], dt, static_cast<int>(stride[0]), w);
+        }
+    });
+}
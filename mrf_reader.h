@@ -0,0 +1,67 @@
+// Direct access to the tiles of a 3D MRF, without going through a GDAL dataset
+// The MRF metadata is parsed once, the index is memory mapped and tiles are read
+// with positional reads, so a single reader can be shared between threads
+#pragma once
+#include <vector>
+#include <string>
+#include <functional>
+#include <gdal.h>
+#include "fileio.h"
+#include "mrf_info.h"
+
+// A tile position, tc is the band for band separate MRFs
+struct TileKey {
+    int tx, ty, z, tc;
+};
+
+// Smallest block along an axis that holds whole input and output pages, up to the axis size
+// in and out are the input and output page sizes along that axis
+int PageUnit(int in, int out, int size);
+
+class MRFReader : public MRFInfo {
+public:
+    MRFReader();
+
+    // Parses the MRF and opens the data and index files, false on failure
+    bool Open(const char *fname);
+    void Close();
+
+    // Whether the tile compression can be decoded here, otherwise why not
+    bool IsSupported() const { return reason.empty(); }
+    const char *Reason() const { return reason.c_str(); }
+    // Whether the index has the usual layout, even if the tiles can't be decoded
+    bool IndexUsable() const { return !v2; }
+
+    // Value for empty tiles
+    void SetFill(double v) { fill = v; }
+
+    // Tile reads kept in flight by ReadTiles, per thread
+    void SetQueueDepth(unsigned d) { depth = d ? d : 1; }
+
+    // Index record for a tile, tc is the band for band separate MRFs
+    TileIdx Index(int tx, int ty, int z, int tc = 0) const;
+
+    // Reads and decodes one tile into page, which has to hold PageBytes()
+    CPLErr ReadTile(int tx, int ty, int z, int tc, void *page, std::vector<char> &scratch) const;
+
+    // Reads and decodes a list of tiles, with up to the queue depth reads in flight
+    // Each decoded page is passed to done with its position in the list, in completion order
+    CPLErr ReadTiles(const std::vector<TileKey> &tiles, const std::function<void(size_t, const char *)> &done) const;
+
+    // Reads a region starting at a page boundary into a [c][z][y][x] buffer, with byte strides
+    // start and size are x, y, z and c, each tile is placed as soon as it is decoded
+    CPLErr ReadBlock(const int start[4], const int size[4], char *buf, const GSpacing stride[4]) const;
+
+private:
+    // Decodes the tile data read from the file into page, in place when not compressed
+    CPLErr Decode(const TileKey &key, char *data, size_t size, char *page) const;
+
+    std::string reason;
+    bool deflate;
+    bool swab;
+    bool v2;
+    double fill;
+    unsigned depth;
+    RawFile datafile, idxfile;
+    MappedFile idxmap;
+};
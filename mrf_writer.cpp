@@ -0,0 +1,305 @@
+#include "mrf_writer.h"
+#include <cstring>
+
+using namespace std;
+
+// Recreate the in memory MRF when its data holds this many pages
+static const size_t ENCODER_PAGES = 4;
+
+// Dedupe table shards
+static const size_t SHARDS = 64;
+
+static inline uint64_t Mix(uint64_t v) {
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    v *= 0xc4ceb9fe1a85ec53ULL;
+    v ^= v >> 33;
+    return v;
+}
+
+// Content hash of a compressed tile, 8 bytes at a time
+// Not collision free, matches are confirmed by comparing the data
+static uint64_t Hash(const char *p, size_t n) {
+    const uint64_t M = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = n * M;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t v;
+        memcpy(&v, p + i, sizeof(v));
+        h = (h ^ Mix(v)) * M;
+    }
+    uint64_t v = 0;
+    memcpy(&v, p + i, n - i);
+    return Mix((h ^ Mix(v)) * M);
+}
+
+class MRFWriter::Encoder {
+public:
+    Encoder(const MRFInfo &info, char **copt, int bHasNoData, double nd, int id) :
+        ds(nullptr), info(info), bHasNoData(bHasNoData), fill(bHasNoData ? nd : 0.0)
+    {
+        fname.Printf("/vsimem/mrf_yzzy_enc_%p_%d.mrf", static_cast<const void *>(&info), id);
+        // Same options, but a single 2D page
+        opts = CSLDuplicate(copt);
+        opts = CSLSetNameValue(opts, "ZSIZE", nullptr);
+        opts = CSLSetNameValue(opts, "UNIFORM_SCALE", nullptr);
+        opts = CSLSetNameValue(opts, "BLOCKXSIZE", CPLOPrintf("%d", info.pszx));
+        opts = CSLSetNameValue(opts, "BLOCKYSIZE", CPLOPrintf("%d", info.pszy));
+        nbands = info.Interleaved() ? info.csz : 1;
+        stage.resize(info.PageBytes());
+    }
+
+    ~Encoder() {
+        Reset();
+        CSLDestroy(opts);
+    }
+
+    // Compresses a page, the result stays valid until the next call
+    // An empty tile is returned with a zero size
+    CPLErr Encode(const char *src, int w, int h, GSpacing pix, GSpacing line, GSpacing band,
+        const char **data, size_t *size)
+    {
+        if (ds && mem.datafname.size()) {
+            vsi_l_offset len = 0;
+            VSIGetMemFileBuffer(mem.datafname, &len, FALSE);
+            if (len > ENCODER_PAGES * stage.size())
+                Reset();
+        }
+
+        if (!ds) {
+            GDALDriverH hdrv = GDALGetDriverByName("MRF");
+            ds = GDALCreate(hdrv, fname, info.pszx, info.pszy, nbands, info.dt, opts);
+            if (!ds)
+                return CE_Failure;
+            if (bHasNoData)
+                for (int c = 1; c <= nbands; c++)
+                    GDALSetRasterNoDataValue(GDALGetRasterBand(ds, c), fill);
+        }
+
+        // Edge pages are padded, the driver would otherwise read the previous tile back
+        int dtsz = info.dtsz;
+        if (w != info.pszx || h != info.pszy) {
+            GSpacing spix = static_cast<GSpacing>(dtsz) * nbands;
+            GSpacing sline = spix * info.pszx;
+            GDALCopyWords64(&fill, GDT_Float64, 0, stage.data(), info.dt, dtsz,
+                static_cast<GIntBig>(stage.size() / dtsz));
+            for (int c = 0; c < nbands; c++)
+                for (int y = 0; y < h; y++)
+                    GDALCopyWords64(src + c * band + y * line, info.dt, static_cast<int>(pix),
+                        stage.data() + c * dtsz + y * sline, info.dt, static_cast<int>(spix), w);
+            src = stage.data();
+            pix = spix;
+            line = sline;
+            band = dtsz;
+        }
+
+        if (CE_None != GDALDatasetRasterIOEx(ds, GF_Write, 0, 0, info.pszx, info.pszy,
+            const_cast<char *>(src), info.pszx, info.pszy, info.dt, nbands, nullptr, pix, line, band, nullptr))
+            return CE_Failure;
+        GDALFlushCache(ds);
+
+        // The in memory files exist after the first write
+        if (!mem.datafname.size() && !mem.Parse(fname))
+            return CE_Failure;
+
+        vsi_l_offset idxlen = 0, datalen = 0;
+        GByte *idx = VSIGetMemFileBuffer(mem.idxfname, &idxlen, FALSE);
+        GByte *dat = VSIGetMemFileBuffer(mem.datafname, &datalen, FALSE);
+        *size = 0;
+        if (!idx || idxlen < sizeof(TileIdx))
+            return CE_None;
+        uint64_t off = GetBE64(reinterpret_cast<char *>(idx));
+        uint64_t sz = GetBE64(reinterpret_cast<char *>(idx) + sizeof(uint64_t));
+        if (sz && (!dat || off + sz > datalen))
+            return CE_Failure;
+        *data = reinterpret_cast<char *>(dat) + off;
+        *size = static_cast<size_t>(sz);
+        return CE_None;
+    }
+
+private:
+    void Reset() {
+        if (ds)
+            GDALClose(ds);
+        ds = nullptr;
+        if (mem.datafname.size()) {
+            VSIUnlink(mem.datafname);
+            VSIUnlink(mem.idxfname);
+        }
+        VSIUnlink(fname);
+        mem = MRFInfo();
+    }
+
+    GDALDatasetH ds;
+    const MRFInfo &info;
+    MRFInfo mem;
+    CPLString fname;
+    char **opts;
+    int nbands;
+    int bHasNoData;
+    double fill;
+    vector<char> stage;
+};
+
+MRFWriter::MRFWriter() : dataend(0), duplicates(0), saved(0) {}
+
+MRFWriter::~MRFWriter() {
+    Close();
+}
+
+bool MRFWriter::Open(const char *fname, char **copt, int nworkers, int bHasNoData, double nd) {
+    if (!Parse(fname))
+        return false;
+    if (!datafile.Open(datafname, true) || !idxfile.Open(idxfname, true)) {
+        CPLError(CE_Failure, CPLE_OpenFailed, "Can't open %s for writing", datafname.c_str());
+        return false;
+    }
+
+    // Missing index records read as empty tiles
+    if (idxfile.Size() < IdxTotalSize() && !idxfile.Truncate(IdxTotalSize())) {
+        CPLError(CE_Failure, CPLE_FileIO, "Can't extend %s", idxfname.c_str());
+        return false;
+    }
+    if (!idxmap.Map(idxfile, IdxTotalSize(), true)) {
+        CPLError(CE_Failure, CPLE_FileIO, "Can't map %s", idxfname.c_str());
+        return false;
+    }
+
+    dataend = datafile.Size();
+    // NoData, or zero when there is none, same as the MRF driver
+    double fill = bHasNoData ? nd : 0.0;
+    int nbands = Interleaved() ? csz : 1;
+    fillrow.resize(static_cast<size_t>(pszx) * nbands * dtsz);
+    GDALCopyWords64(&fill, GDT_Float64, 0, fillrow.data(), dt, dtsz, static_cast<GIntBig>(fillrow.size() / dtsz));
+    for (int i = 0; i < nworkers; i++)
+        encoders.emplace_back(new Encoder(*this, copt, bHasNoData, nd, i));
+    return true;
+}
+
+// The staging page, the in memory data file up to the limit and one more page, which can be larger
+// when compressed
+size_t MRFWriter::EncoderBytes(size_t pagebytes) {
+    return (ENCODER_PAGES + 3) * pagebytes;
+}
+
+void MRFWriter::SetDedupe(bool on) {
+    shards.reset(on ? new Shard[SHARDS] : nullptr);
+}
+
+bool MRFWriter::Close() {
+    encoders.clear();
+    bool ok = idxmap.Sync();
+    idxmap.Unmap();
+    if (datafile.IsOpen())
+        ok = datafile.Sync() && ok;
+    if (idxfile.IsOpen())
+        ok = idxfile.Sync() && ok;
+    datafile.Close();
+    idxfile.Close();
+    shards.reset();
+    return ok;
+}
+
+CPLErr MRFWriter::WriteTile(int worker, int tx, int ty, int z, int tc,
+    const char *src, int w, int h, GSpacing pix, GSpacing line, GSpacing band, bool *stored, int level)
+{
+    if (stored)
+        *stored = false;
+    if (IsFill(src, w, h, pix, line, band))
+        return CE_None;
+    const char *data = nullptr;
+    size_t size = 0;
+    if (CE_None != encoders[worker]->Encode(src, w, h, pix, line, band, &data, &size)) {
+        CPLError(CE_Failure, CPLE_AppDefined, "Can't encode tile %d,%d,%d", tx, ty, z);
+        return CE_Failure;
+    }
+    // Empty tiles keep the zero index record
+    if (!size)
+        return CE_None;
+    if (stored)
+        *stored = true;
+    return Store(IdxOffset(tx, ty, z, tc, level), data, size);
+}
+
+bool MRFWriter::IsFill(const char *src, int w, int h, GSpacing pix, GSpacing line, GSpacing band) const {
+    int nbands = Interleaved() ? csz : 1;
+    // Rows are contiguous in the transposed cublock
+    if (pix == static_cast<GSpacing>(nbands) * dtsz && (nbands == 1 || band == dtsz)) {
+        size_t rowsz = static_cast<size_t>(w) * pix;
+        for (int y = 0; y < h; y++)
+            if (memcmp(src + y * line, fillrow.data(), rowsz))
+                return false;
+        return true;
+    }
+    for (int c = 0; c < nbands; c++)
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++)
+                if (memcmp(src + c * band + y * line + x * pix, fillrow.data(), dtsz))
+                    return false;
+    return true;
+}
+
+// Appends the tile, then points the index record to it
+// Each tile gets its own range of the data file and its own index record, no locking needed
+// With dedupe, the table only lists tiles already written, two threads storing the same new
+// tile at the same time both write it
+CPLErr MRFWriter::Store(uint64_t idxoffset, const char *data, size_t size) {
+    uint64_t hash = 0, offset = 0;
+    Shard *shard = nullptr;
+    if (shards) {
+        hash = Hash(data, size);
+        shard = &shards[hash % SHARDS];
+        if (Find(*shard, hash, data, size, offset)) {
+            duplicates++;
+            saved += size;
+            PutRecord(idxoffset, offset, size);
+            return CE_None;
+        }
+    }
+
+    offset = dataend.fetch_add(size);
+    if (datafile.PWrite(data, size, offset) != static_cast<int64_t>(size)) {
+        CPLError(CE_Failure, CPLE_FileIO, "Can't write to %s", datafname.c_str());
+        return CE_Failure;
+    }
+    if (shard) {
+        TileIdx ti = { offset, size };
+        lock_guard<mutex> lock(shard->mtx);
+        shard->tiles.emplace(hash, ti);
+    }
+    PutRecord(idxoffset, offset, size);
+    return CE_None;
+}
+
+// Written after the data, a record never points to a range that is not there yet
+void MRFWriter::PutRecord(uint64_t idxoffset, uint64_t offset, uint64_t size) {
+    char *rec = idxmap.Data() + idxoffset;
+    PutBE64(rec, offset);
+    PutBE64(rec + sizeof(uint64_t), size);
+}
+
+bool MRFWriter::Find(Shard &shard, uint64_t hash, const char *data, size_t size, uint64_t &offset) const {
+    // Candidates are copied, the compare reads happen without the lock
+    vector<uint64_t> offsets;
+    {
+        lock_guard<mutex> lock(shard.mtx);
+        auto range = shard.tiles.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+            if (it->second.size == size)
+                offsets.push_back(it->second.offset);
+    }
+    if (offsets.empty())
+        return false;
+
+    // Recently written, the data is in the page cache
+    thread_local vector<char> stored;
+    stored.resize(size);
+    for (uint64_t off : offsets) {
+        if (datafile.PRead(stored.data(), size, off) == static_cast<int64_t>(size) && !memcmp(stored.data(), data, size)) {
+            offset = off;
+            return true;
+        }
+    }
+    return false;
+}
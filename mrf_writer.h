@@ -0,0 +1,68 @@
+// Direct tile output for a 3D MRF created by GDAL
+// Tiles are compressed by per worker encoders, then appended to the data file and the
+// index records are written here, so many threads can produce tiles at the same time
+// Appends reserve their range with an atomic add on the end offset, the index is memory mapped
+// With dedupe, a tile identical to one already stored only gets an index record pointing to it
+#pragma once
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <gdal.h>
+#include "fileio.h"
+#include "mrf_info.h"
+
+class MRFWriter : public MRFInfo {
+public:
+    MRFWriter();
+    ~MRFWriter();
+
+    // Opens an existing MRF for appending tiles, the index is extended to full size
+    // copt are the creation options, used by the encoders, NoData is also the value past the edges
+    bool Open(const char *fname, char **copt, int nworkers, int bHasNoData, double nd);
+    bool Close();
+    // Memory used by each encoder, for an output page of pagebytes
+    static size_t EncoderBytes(size_t pagebytes);
+
+    // Keeps a content hash of the stored tiles, repeated tiles are written once
+    void SetDedupe(bool on);
+    // Tiles that reused a stored copy, and the bytes not written
+    uint64_t Duplicates() const { return duplicates; }
+    uint64_t SavedBytes() const { return saved; }
+
+    // Compresses and stores one page, tc is the band for band separate MRFs
+    // src holds w by h pixels of the page, with pixel, line and band strides
+    // Pages that only hold the fill value are left empty, stored is false then
+    // Overview pages have a level from 1
+    // Each worker can only be used by one thread at a time
+    CPLErr WriteTile(int worker, int tx, int ty, int z, int tc,
+        const char *src, int w, int h, GSpacing pix, GSpacing line, GSpacing band, bool *stored = nullptr,
+        int level = 0);
+
+private:
+    // Compresses tiles with the MRF driver, using a single page MRF in memory
+    class Encoder;
+
+    CPLErr Store(uint64_t idxoffset, const char *data, size_t size);
+    void PutRecord(uint64_t idxoffset, uint64_t offset, uint64_t size);
+
+    // Stored tiles by content hash, sharded so the locks are short
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_multimap<uint64_t, TileIdx> tiles;
+    };
+    // A stored tile with the same content, compared byte by byte
+    bool Find(Shard &shard, uint64_t hash, const char *data, size_t size, uint64_t &offset) const;
+    // Whether every value is the fill value, which is what empty tiles read as
+    bool IsFill(const char *src, int w, int h, GSpacing pix, GSpacing line, GSpacing band) const;
+
+    std::vector<std::unique_ptr<Encoder>> encoders;
+    RawFile datafile, idxfile;
+    MappedFile idxmap;
+    std::atomic<uint64_t> dataend;
+    std::unique_ptr<Shard[]> shards;
+    std::atomic<uint64_t> duplicates, saved;
+    // Fill values for a page row, all bands
+    std::vector<char> fillrow;
+};
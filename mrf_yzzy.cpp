@@ -2,8 +2,25 @@
 #include <string>
 #include <algorithm>
 #include <iostream>
+#include <map>
+#include <thread>
+#include <atomic>
 #include <gdal.h>
 #include <cpl_string.h>
+#include "pipeline.h"
+#include "mrf_reader.h"
+#include "mrf_writer.h"
+#include "transpose.h"
+#include "stats.h"
+#include "journal.h"
+#include "merge.h"
+#include "arena.h"
+#include "bandstats.h"
+#include "overviews.h"
+#include "append.h"
+#include "slicelist.h"
+#include "options.h"
+#include "reduce.h"
 
 using namespace std;
 
@@ -11,21 +28,1049 @@ int Usage(const char *message = nullptr, int retcode = 1) {
     if (message)
         cerr << message << endl;
 
-    cerr << "mrf_yzzy transposes the data in a 3rD MRF by swapping the Y and Z axis" << endl
+    cerr << "mrf_yzzy transposes the data in a 3rD MRF by swapping the Y and Z axis, or in any axis order" << endl
         << "Usage:" << endl
-        << "mrf_yzzy [-z ZPageSize] [-v] [-g] in.mrf out.mrf" << endl << endl
+        << "mrf_yzzy [-z ZPageSize] [--axes XYZC] [-j Threads] [-m MiB] [-b Bands] [--part i/N | --ylines a:b | --append-from Z]"
+        << " [-co NAME=VALUE]... [--compute-stats] [--hist] [--overviews 2,4,...] [-r average|nearest] [--dedupe] [--reduce mean,min,...] [--stats report.json] [--resume] [-v] [-g] in.mrf|@list.txt|pattern out.mrf" << endl
+        << "mrf_yzzy merge [-v] out.mrf part1.mrf part2.mrf ..." << endl << endl
+        << "\tThe input is a 3D MRF, or 2D rasters as the Z slices, listed one per line in list.txt or matching a pattern" << endl
         << "\t-z ZPageSize : Set the output Y pagesize" << endl
+        << "\t-co NAME=VALUE : Output MRF creation option, overrides the one from the input" << endl
+        << "\t--axes XYZC : The input axes that become the output x, y, z and bands, from x, y, z and c" << endl
+        << "\t\tThe default is xzyc, swapping Y and Z. A missing fourth one goes to the bands" << endl
+        << "\t-j Threads : Pipelined mode, using this many reader threads, otherwise the next cublock is read ahead" << endl
+        << "\t-m MiB : Memory budget, picks the cublock size and the GDAL cache size, after the tile encoders" << endl
+        << "\t-b Bands : Band group size, groups are transposed independently" << endl
+        << "\t--part i/N : Only writes part i of N, from 1, a range of output Z slices" << endl
+        << "\t--ylines a:b : Only writes the output Z slices from a to b - 1, the input Y rows when swapping Y and Z" << endl
+        << "\t\tParts start at a multiple of the input page size along that axis" << endl
+        << "\t--append-from Z : Adds the input Z slices from Z on to an existing output, which grows to fit them" << endl
+        << "\t\tWhen swapping Y and Z, these are the new output Y lines of every slice" << endl
+        << "\tmerge : Joins the parts into one MRF, without recompressing" << endl
+        << "\t--compute-stats : Sets the statistics of every output band, computed while transposing" << endl
+        << "\t\tOtherwise the input band 1 statistics are copied, if present" << endl
+        << "\t--hist : Also sets the histograms, for 8 bit data" << endl
+        << "\t--overviews 2,4,... : Builds the overviews of every output slice from the transposed data" << endl
+        << "\t\tThe levels are powers of one scale, the MRF holds them down to a single tile" << endl
+        << "\t-r average|nearest : Overview resampling, average skips NoData" << endl
+        << "\t--dedupe : Stores identical output tiles once, when writing tiles directly" << endl
+        << "\t--reduce mean,min,max,count,p50,... : Also writes these reductions along the input Z axis as 2D MRFs," << endl
+        << "\t\tout_mean.mrf and so on, percentiles are estimated. The output slices have to be along input x or y" << endl
+        << "\t--stats report.json : Writes the time spent in each phase, data sizes and throughput" << endl
+        << "\t--resume : Continues an interrupted run, from the out.mrf.journal progress file" << endl
         << "\t-v : verbose" << endl
         << "\t-g copies the input projection and the area info, which will be wrong anyhow" << endl;
 
     return retcode;
 }
 
+// Everything the stages need to know about the input and the output
+struct Cube {
+    string SourceName, TargetName;
+    // The input Z slices, when they are separate 2D rasters
+    vector<string> slices;
+    int xsz, ysz, zsz, csz;     // Input size
+    int pszx, pszy;             // Input page size, also the output X page size
+    int psz;                    // Output Y page size
+    GDALDataType dt;
+    int dtsz;
+
+    // The input axis for output x, y, z and band, {AX_X, AX_Z, AX_Y, AX_C} swaps Y and Z
+    int axes[4];
+    int osz[4];                 // Output size, in the same order
+    int slo, shi;               // Output Z slices written by this run, all unless it is a part
+    int zlo;                    // First input Z slice, past 0 when appending
+
+    // Cublock geometry, multiples of the input and output page sizes
+    int zdepth;                 // Z group depth
+    int yblk;                   // Height
+    int xblk;                   // Width
+    int cband;                  // Bands per pass
+    int cgroup;                 // Bands per group, transposed independently within a pass
+    int gthreads;               // Threads transposing groups or slices
+
+    // Input buffer strides, the cublock is stored as [c][z][y][x]
+    GSpacing pix_stride, line_stride, z_stride, band_stride;
+    // Output buffer strides, the transposed cublock is [oz][oc][oy][ox]
+    // or [oz][oy][ox][oc] when the output is pixel interleaved, same as an MRF page
+    // For the Y and Z swap, that is [y][c][z][x] or [y][z][x][c]
+    bool iinterleaved;          // Input is pixel interleaved
+    bool interleaved;           // Output is pixel interleaved
+    GSpacing opix_stride, oline_stride, oband_stride, oslice_stride;
+    size_t BSZ;
+
+    // Cublock buffers
+    Arena *arena;
+
+    // Direct tile access to the input, when available
+    const MRFReader *reader;
+    // The input index, when it can be read
+    const MRFReader *index;
+    // Otherwise, input datasets kept open by each reader
+    size_t maxopen;
+
+    // Direct tile output and its encoder threads, when available
+    MRFWriter *writer;
+    ThreadPool *pool;
+
+    // Timing and progress, shared by all stages
+    Stats *stats;
+    // Completed cublocks, the run starts at first
+    Journal *journal;
+    size_t first;
+    bool resume;                // The output exists, slices are updated
+
+    // Output creation
+    GDALDriverH d_mrf;
+    char **copt;
+    int bHasNoData;
+    double nd;
+    int bHasStats;
+    double min_v, max_v, mean_v, stdd_v;
+    // Output band statistics, computed from the transposed cublocks when set
+    BandStats *bandstats;
+    // Output overviews, built from the transposed cublocks when set
+    Overviews *overviews;
+    // Reductions along the input Z, from the input cublocks when set, and their outputs
+    Reductions *reductions;
+    vector<GDALDatasetH> reduceh;
+    bool geo;
+    CPLString projection;
+    double gt[6];
+};
+
+// One unit of work, a tile stack of the input
+struct Cublock {
+    size_t seq;
+    int startx, starty, startz, startc;
+    int dx, dy, dz, dc;
+    char *buffer;               // As read
+    char *outbuffer;            // Transposed
+    bool empty;                 // All input tiles are empty, nothing to read or write
+};
+
+// Input size, cublock size and cublock position along an input axis
+static int Size(const Cube &cube, int axis) {
+    return axis == AX_X ? cube.xsz : axis == AX_Y ? cube.ysz : axis == AX_Z ? cube.zsz : cube.csz;
+}
+
+static int Block(const Cube &cube, int axis) {
+    return axis == AX_X ? cube.xblk : axis == AX_Y ? cube.yblk : axis == AX_Z ? cube.zdepth : cube.cband;
+}
+
+static int Start(const Cublock &cb, int axis) {
+    return axis == AX_X ? cb.startx : axis == AX_Y ? cb.starty : axis == AX_Z ? cb.startz : cb.startc;
+}
+
+// Range of an input axis covered by this run, only the output slice axis and, when appending,
+// the input Z axis can be partial
+static int Lo(const Cube &cube, int axis) {
+    return axis == cube.axes[2] ? cube.slo : axis == AX_Z ? cube.zlo : 0;
+}
+
+static int Hi(const Cube &cube, int axis) {
+    return axis == cube.axes[2] ? cube.shi : Size(cube, axis);
+}
+
+static int Extent(const Cublock &cb, int axis) {
+    return axis == AX_X ? cb.dx : axis == AX_Y ? cb.dy : axis == AX_Z ? cb.dz : cb.dc;
+}
+
+// Input buffer stride along an axis
+static GSpacing Stride(const Cube &cube, int axis) {
+    return axis == AX_X ? cube.pix_stride : axis == AX_Y ? cube.line_stride
+        : axis == AX_Z ? cube.z_stride : cube.band_stride;
+}
+
+static bool IsYZSwap(const Cube &cube) {
+    return cube.axes[0] == AX_X && cube.axes[1] == AX_Z && cube.axes[2] == AX_Y && cube.axes[3] == AX_C;
+}
+
+// Smallest cublock size along an input axis, whole input and output pages
+// Pixel interleaved output pages hold all the output bands
+static int Unit(const Cube &cube, int axis) {
+    int in = axis == AX_X ? cube.pszx : axis == AX_Y ? cube.pszy : 1;
+    int out = axis == cube.axes[0] ? cube.pszx : axis == cube.axes[1] ? cube.psz : 1;
+    if (axis == cube.axes[3] && cube.interleaved)
+        out = Size(cube, axis);
+    return PageUnit(in, out, Size(cube, axis));
+}
+
+// The input Z slice datasets, one per slice
+// They stay open across groups, up to maxopen, the least recently used is closed first
+// Not needed when reading tiles directly
+struct InputGroup {
+    int startz = -1;
+    vector<GDALDatasetH> inh;           // The current group
+    map<int, pair<GDALDatasetH, size_t>> pool;   // Slice to handle and last use
+    size_t tick = 0;
+
+    bool Open(const Cube &cube, int z0) {
+        startz = z0;
+        if (cube.reader)
+            return true;
+        int dz = min(cube.zdepth, cube.zsz - z0);
+        inh.assign(dz, nullptr);
+        for (int z = 0; z < dz; z++) {
+            auto it = pool.find(z0 + z);
+            if (it == pool.end()) {
+                CPLString SName;
+                if (cube.slices.empty())
+                    SName.Printf("%s:MRF:Z%d", cube.SourceName.c_str(), z0 + z);
+                else
+                    SName = cube.slices[z0 + z];
+                GDALDatasetH h = GDALOpen(SName, GA_ReadOnly);
+                if (!h)
+                    return false;
+                // Listed rasters have to match the first one
+                if (!cube.slices.empty() && (GDALGetRasterXSize(h) != cube.xsz || GDALGetRasterYSize(h) != cube.ysz
+                    || GDALGetRasterCount(h) != cube.csz))
+                {
+                    CPLError(CE_Failure, CPLE_AppDefined, "%s doesn't match the size of %s",
+                        SName.c_str(), cube.slices[0].c_str());
+                    GDALClose(h);
+                    return false;
+                }
+                it = pool.insert(make_pair(z0 + z, make_pair(h, size_t(0)))).first;
+            }
+            it->second.second = ++tick;
+            inh[z] = it->second.first;
+        }
+
+        // The current group has the latest ticks, it never gets closed
+        while (pool.size() > max(cube.maxopen, static_cast<size_t>(dz))) {
+            auto lru = pool.begin();
+            for (auto it = pool.begin(); it != pool.end(); it++)
+                if (it->second.second < lru->second.second)
+                    lru = it;
+            GDALClose(lru->second.first);
+            pool.erase(lru);
+        }
+        return true;
+    }
+
+    void Close() {
+        for (auto &it : pool)
+            GDALClose(it.second.first);
+        pool.clear();
+        inh.clear();
+        startz = -1;
+    }
+};
+
+// The output Z slices written from one group of cublocks, starty when swapping Y and Z
+// Each is created once, since all the passes for it are done in sequence
+struct OutputGroup {
+    int start = -1;
+    vector<GDALDatasetH> outh;
+    const BandStats *bandstats = nullptr;
+
+    bool Open(const Cube &cube, int s0) {
+        Close();
+        start = s0;
+        bandstats = cube.bandstats;
+        int ds = min(Block(cube, cube.axes[2]), cube.shi - s0);
+        outh.assign(ds, nullptr);
+        for (int z = 0; z < ds; z++) {
+            CPLString DName;
+            DName.Printf("%s:MRF:Z%d", cube.TargetName.c_str(), s0 + z);
+            GDALDatasetH h = cube.resume ? GDALOpen(DName.c_str(), GA_Update)
+                : GDALCreate(cube.d_mrf, DName.c_str(), cube.osz[0], cube.osz[1], cube.osz[3], cube.dt, cube.copt);
+            if (!h)
+                return false;
+            GDALRasterBandH b = GDALGetRasterBand(h, 1);
+            if (cube.bHasNoData)
+                GDALSetRasterNoDataValue(b, cube.nd);
+            if (cube.bHasStats && !cube.bandstats)
+                GDALSetRasterStatistics(b, cube.min_v, cube.max_v, cube.mean_v, cube.stdd_v);
+            if (cube.geo) {
+                GDALSetProjection(h, cube.projection);
+                GDALSetGeoTransform(h, const_cast<double *>(cube.gt));
+            }
+            outh[z] = h;
+        }
+        return true;
+    }
+
+    // The statistics are complete once the group is done
+    void Close() {
+        for (size_t i = 0; i < outh.size(); i++)
+            if (outh[i]) {
+                if (bandstats)
+                    bandstats->Apply(start + static_cast<int>(i), outh[i]);
+                GDALClose(outh[i]);
+            }
+        outh.clear();
+        start = -1;
+    }
+};
+
+// Cublocks along an input axis
+static size_t Blocks(const Cube &cube, int axis) {
+    return (Hi(cube, axis) - Lo(cube, axis) + Block(cube, axis) - 1) / Block(cube, axis);
+}
+
+// Cublock loop order, outermost first
+// The axis of the output slices is outermost, so every output slice is finished before moving on
+// For the Y and Z swap, this is the starty, startc, startz, startx order
+static void LoopOrder(const Cube &cube, int order[4]) {
+    static const int rest[4] = { AX_C, AX_Z, AX_Y, AX_X };
+    order[0] = cube.axes[2];
+    for (int i = 0, j = 1; i < 4; i++)
+        if (rest[i] != cube.axes[2])
+            order[j++] = rest[i];
+}
+
+static size_t CublockCount(const Cube &cube) {
+    return Blocks(cube, AX_X) * Blocks(cube, AX_Y) * Blocks(cube, AX_Z) * Blocks(cube, AX_C);
+}
+
+// Cublocks with the same start along the output slice axis, consecutive in loop order
+static size_t GroupCount(const Cube &cube) {
+    return CublockCount(cube) / Blocks(cube, cube.axes[2]);
+}
+
+static void Locate(const Cube &cube, size_t seq, Cublock &cb) {
+    int order[4], start[4];
+    LoopOrder(cube, order);
+    cb.seq = seq;
+    for (int i = 3; i >= 0; i--) {
+        size_t n = Blocks(cube, order[i]);
+        start[order[i]] = Lo(cube, order[i]) + static_cast<int>(seq % n) * Block(cube, order[i]);
+        seq /= n;
+    }
+    cb.startx = start[AX_X];
+    cb.starty = start[AX_Y];
+    cb.startz = start[AX_Z];
+    cb.startc = start[AX_C];
+    cb.dx = min(cube.xblk, Hi(cube, AX_X) - cb.startx);
+    cb.dy = min(cube.yblk, Hi(cube, AX_Y) - cb.starty);
+    cb.dz = min(cube.zdepth, Hi(cube, AX_Z) - cb.startz);
+    cb.dc = min(cube.cband, Hi(cube, AX_C) - cb.startc);
+}
+
+// GDAL band numbers, for count bands from start
+static vector<int> BandMap(int start, int count) {
+    vector<int> bands(count);
+    for (int c = 0; c < count; c++)
+        bands[c] = start + c + 1;
+    return bands;
+}
+
+// The output tiles of a cublock, for every output slice and band
+// Tile i is the band c, output page at x0, y0 in output slice k, all relative to the cublock
+struct OutTiles {
+    int ntx, nty, ntc, nz;
+    int pszx, pszy;
+
+    OutTiles(const Cube &cube, const Cublock &cb) : pszx(cube.pszx), pszy(cube.psz) {
+        ntx = (Extent(cb, cube.axes[0]) + pszx - 1) / pszx;
+        nty = (Extent(cb, cube.axes[1]) + pszy - 1) / pszy;
+        ntc = cube.interleaved ? 1 : Extent(cb, cube.axes[3]);
+        nz = Extent(cb, cube.axes[2]);
+    }
+
+    size_t Count() const {
+        return static_cast<size_t>(nz) * nty * ntx * ntc;
+    }
+
+    void Get(size_t i, int &x0, int &y0, int &k, int &c) const {
+        c = static_cast<int>(i % ntc);
+        x0 = static_cast<int>((i / ntc) % ntx) * pszx;
+        y0 = static_cast<int>((i / ntc / ntx) % nty) * pszy;
+        k = static_cast<int>(i / ntc / ntx / nty);
+    }
+};
+
+// Read a cublock straight from the input tiles
+// All the tile reads are queued at once, each tile is placed as soon as it is decoded
+static CPLErr ReadCublockDirect(const Cube &cube, Cublock &cb) {
+    int start[4] = { cb.startx, cb.starty, cb.startz, cb.startc };
+    int size[4] = { cb.dx, cb.dy, cb.dz, cb.dc };
+    GSpacing stride[4] = { cube.pix_stride, cube.line_stride, cube.z_stride, cube.band_stride };
+    return cube.reader->ReadBlock(start, size, cb.buffer, stride);
+}
+
+// Read a cublock, each Z slice is a different dataset
+static CPLErr ReadCublock(const Cube &cube, InputGroup &in, Cublock &cb) {
+    if (cube.reader)
+        return ReadCublockDirect(cube, cb);
+    vector<int> bands = BandMap(cb.startc, cb.dc);
+    for (int z = 0; z < cb.dz; z++) {
+        //fprintf(stderr,
+        //    "Reading Z%d %d,%d - %d,%d %d stride %d %d %d\n",
+        //    cb.startz + z, cb.startx, cb.starty, cb.dx, cb.dy,
+        //    cube.z_stride * (z + cb.startz), cube.pix_stride, cube.line_stride, cube.band_stride
+        //);
+        CPLErr err = GDALDatasetRasterIOEx(in.inh[z], GF_Read,
+            cb.startx, cb.starty, cb.dx, cb.dy,
+            cb.buffer + cube.z_stride * z, cb.dx, cb.dy,
+            cube.dt, cb.dc, bands.data(),
+            cube.pix_stride, cube.line_stride, cube.band_stride, nullptr
+        );
+        if (err != CE_None)
+            return err;
+    }
+    return CE_None;
+}
+
+// Whether all the input tiles of a cublock are empty, from the input index
+static bool IsEmpty(const Cube &cube, const Cublock &cb) {
+    if (!cube.index)
+        return false;
+    const MRFReader &r = *cube.index;
+    int c1 = r.Interleaved() ? 1 : cb.startc + cb.dc;
+    for (int z = cb.startz; z < cb.startz + cb.dz; z++)
+        for (int ty = cb.starty / cube.pszy; ty * cube.pszy < cb.starty + cb.dy; ty++)
+            for (int tx = cb.startx / cube.pszx; tx * cube.pszx < cb.startx + cb.dx; tx++)
+                for (int tc = r.Interleaved() ? 0 : cb.startc; tc < c1; tc++)
+                    if (r.Index(tx, ty, z, tc).size)
+                        return false;
+    return true;
+}
+
+// Opens the input group if needed, then reads
+// Empty cublocks are not read
+static CPLErr FetchCublock(const Cube &cube, InputGroup &in, Cublock &cb) {
+    cube.stats->Locate(cb.seq, cb.startx, cb.starty, cb.startz, cb.startc);
+    cb.empty = IsEmpty(cube, cb);
+    if (cb.empty)
+        return CE_None;
+    if (in.startz != cb.startz) {
+        StageTimer t;
+        bool ok = in.Open(cube, cb.startz);
+        cube.stats->Add(PH_OPEN, t.Seconds(), cb.seq);
+        if (!ok)
+            return CE_Failure;
+    }
+    StageTimer t;
+    CPLErr err = ReadCublock(cube, in, cb);
+    cube.stats->Add(PH_READ, t.Seconds(), cb.seq);
+    return err;
+}
+
+// Swap Y and Z, input rows become output rows
+// Band separate only changes the row order, pixel interleaved also interleaves the bands
+// The bands of a group are contiguous in the input buffer, and in the output one when band
+// separate, so groups are done one at a time, staying in cache, and in parallel
+static void SwapYZ(const Cube &cube, Cublock &cb) {
+    size_t rowsz = static_cast<size_t>(cb.dx) * cube.dtsz;
+    int ngroups = (cb.dc + cube.cgroup - 1) / cube.cgroup;
+    ParallelFor(ngroups, cube.gthreads, [&](int g) {
+        int c0 = g * cube.cgroup;
+        int c1 = min(cb.dc, c0 + cube.cgroup);
+        vector<const char *> src(c1 - c0);
+        for (int y = 0; y < cb.dy; y++) {
+            char *slice = cb.outbuffer + y * cube.oslice_stride;
+            for (int z = 0; z < cb.dz; z++) {
+                const char *row = cb.buffer + z * cube.z_stride + y * cube.line_stride;
+                char *orow = slice + z * cube.oline_stride;
+                if (cube.interleaved) {
+                    for (int c = c0; c < c1; c++)
+                        src[c - c0] = row + c * cube.band_stride;
+                    InterleaveRow(cube.dtsz, c1 - c0, src.data(), cb.dx, orow + c0 * cube.oband_stride, cb.dc);
+                }
+                else {
+                    for (int c = c0; c < c1; c++)
+                        memcpy(orow + c * cube.oband_stride, row + c * cube.band_stride, rowsz);
+                }
+            }
+        }
+    });
+}
+
+// Any axis order, the output slices are done in parallel
+static void Permute(const Cube &cube, Cublock &cb) {
+    // Output axes, innermost first
+    int order[3] = { cube.axes[0], cube.axes[1], cube.axes[3] };
+    ptrdiff_t dstride[3] = { cube.opix_stride, cube.oline_stride, cube.oband_stride };
+    if (cube.interleaved) {
+        int o[3] = { cube.axes[3], cube.axes[0], cube.axes[1] };
+        ptrdiff_t d[3] = { cube.oband_stride, cube.opix_stride, cube.oline_stride };
+        copy(o, o + 3, order);
+        copy(d, d + 3, dstride);
+    }
+    size_t dims[3];
+    ptrdiff_t sstride[3];
+    for (int i = 0; i < 3; i++) {
+        dims[i] = Extent(cb, order[i]);
+        sstride[i] = Stride(cube, order[i]);
+    }
+    GSpacing zstride = Stride(cube, cube.axes[2]);
+    ParallelFor(Extent(cb, cube.axes[2]), cube.gthreads, [&](int k) {
+        PermuteBlock(cube.dtsz, dims, cb.buffer + k * zstride, sstride, cb.outbuffer + k * cube.oslice_stride, dstride);
+    });
+}
+
+// Adds the transposed cublock to the output statistics, slices in parallel
+static void ReduceCublock(const Cube &cube, Cublock &cb) {
+    int ax = cube.axes[0], ay = cube.axes[1], az = cube.axes[2], ac = cube.axes[3];
+    ParallelFor(Extent(cb, az), cube.gthreads, [&](int k) {
+        for (int c = 0; c < Extent(cb, ac); c++)
+            cube.bandstats->Add(Start(cb, az) + k, Start(cb, ac) + c,
+                cb.outbuffer + k * cube.oslice_stride + c * cube.oband_stride,
+                Extent(cb, ax), Extent(cb, ay), cube.opix_stride, cube.oline_stride);
+    });
+}
+
+// Adds the input cublock to the reductions along Z, bands and row ranges in parallel
+// Reads the input buffer, the Z values of a pixel are a z stride apart
+static void ReduceZ(const Cube &cube, Cublock &cb) {
+    int nrows = min(cb.dy, cube.gthreads);
+    ParallelFor(cb.dc * nrows, cube.gthreads, [&](int i) {
+        int c = i / nrows, k = i % nrows;
+        int y0 = cb.dy * k / nrows, y1 = cb.dy * (k + 1) / nrows;
+        cube.reductions->Add(cb.startx, cb.starty + y0, cb.startc + c,
+            cb.buffer + c * cube.band_stride + y0 * cube.line_stride, cb.dx, y1 - y0, cb.dz,
+            cube.pix_stride, cube.line_stride, cube.z_stride);
+    });
+}
+
+static void TransposeCublock(const Cube &cube, Cublock &cb) {
+    // Empty tiles read as NoData, which has no statistics, or as zero when there is none
+    if (cb.empty) {
+        if (cube.bandstats && !cube.bHasNoData)
+            for (int k = 0; k < Extent(cb, cube.axes[2]); k++)
+                for (int c = 0; c < Extent(cb, cube.axes[3]); c++)
+                    cube.bandstats->AddConstant(Start(cb, cube.axes[2]) + k, Start(cb, cube.axes[3]) + c, 0,
+                        static_cast<uint64_t>(Extent(cb, cube.axes[0])) * Extent(cb, cube.axes[1]));
+        if (cube.reductions)
+            for (int c = 0; c < cb.dc; c++)
+                cube.reductions->AddConstant(cb.startx, cb.starty, cb.startc + c, cb.dx, cb.dy, cb.dz,
+                    cube.bHasNoData ? cube.nd : 0);
+        return;
+    }
+    StageTimer t;
+    if (IsYZSwap(cube))
+        SwapYZ(cube, cb);
+    else
+        Permute(cube, cb);
+    if (cube.bandstats)
+        ReduceCublock(cube, cb);
+    if (cube.reductions)
+        ReduceZ(cube, cb);
+    cube.stats->Add(PH_TRANSPOSE, t.Seconds(), cb.seq);
+}
+
+// Write a transposed cublock, each input row becomes part of an output Z slice
+// In general, each position along the output z axis is a slice
+static CPLErr WriteCublock(const Cube &cube, OutputGroup &out, Cublock &cb) {
+    int ax = cube.axes[0], ay = cube.axes[1], ac = cube.axes[3];
+    vector<int> bands = BandMap(Start(cb, ac), Extent(cb, ac));
+    for (int endz = 0; endz < Extent(cb, cube.axes[2]); endz++) {
+        //fprintf(stderr,
+        //    "Writing Z%d %d,%d - %d,%d %d stride %d %d %d\n",
+        //    cb.starty + endz, cb.startx, cb.startz, cb.dx, cb.dz,
+        //    endz * cube.oslice_stride, cube.opix_stride, cube.oline_stride, cube.oband_stride
+        //);
+        CPLErr err = GDALDatasetRasterIOEx(out.outh[endz], GF_Write,
+            Start(cb, ax), Start(cb, ay), Extent(cb, ax), Extent(cb, ay),
+            cb.outbuffer + endz * cube.oslice_stride, Extent(cb, ax), Extent(cb, ay),
+            cube.dt, Extent(cb, ac), bands.data(),
+            cube.opix_stride, cube.oline_stride, cube.oband_stride, nullptr
+        );
+        if (err != CE_None)
+            return err;
+    }
+    return CE_None;
+}
+
+// Write a transposed cublock as output tiles, compressed in parallel
+// Tiles that are all NoData are left empty, written counts the others
+static CPLErr WriteCublockDirect(const Cube &cube, Cublock &cb, uint64_t &written) {
+    MRFWriter &w = *cube.writer;
+    OutTiles tiles(cube, cb);
+    int ax = cube.axes[0], ay = cube.axes[1], az = cube.axes[2], ac = cube.axes[3];
+    atomic<int> failed(0);
+    atomic<uint64_t> nstored(0);
+    cube.pool->Run(tiles.Count(), [&](size_t i, int worker) {
+        int x0, y0, k, c;
+        bool stored = false;
+        tiles.Get(i, x0, y0, k, c);
+        const char *src = cb.outbuffer + k * cube.oslice_stride + y0 * cube.oline_stride
+            + x0 * cube.opix_stride + c * cube.oband_stride;
+        if (failed || CE_None != w.WriteTile(worker, (Start(cb, ax) + x0) / w.pszx, (Start(cb, ay) + y0) / w.pszy,
+            Start(cb, az) + k, w.Interleaved() ? 0 : Start(cb, ac) + c, src,
+            min(w.pszx, Extent(cb, ax) - x0), min(w.pszy, Extent(cb, ay) - y0),
+            cube.opix_stride, cube.oline_stride, cube.oband_stride, &stored))
+            failed = 1;
+        if (stored)
+            nstored++;
+    });
+    written = nstored;
+    return failed ? CE_Failure : CE_None;
+}
+
+// Sets the statistics of an output slice group written directly
+static bool ApplyBandStats(const Cube &cube, int s0) {
+    int s1 = min(s0 + Block(cube, cube.axes[2]), cube.shi);
+    for (int z = s0; z < s1; z++) {
+        CPLString DName;
+        DName.Printf("%s:MRF:Z%d", cube.TargetName.c_str(), z);
+        GDALDatasetH h = GDALOpen(DName, GA_Update);
+        if (!h)
+            return false;
+        cube.bandstats->Apply(z, h);
+        GDALClose(h);
+    }
+    return true;
+}
+
+// Writes a complete overview tile through GDAL, band by band
+static bool WriteOverviewTile(const Cube &cube, const OutputGroup &out, int level, int tx, int ty, int z, int tc,
+    const char *tile, int w, int h, GSpacing pix, GSpacing line, GSpacing band)
+{
+    int nbt = cube.interleaved ? cube.osz[3] : 1;
+    for (int b = 0; b < nbt; b++) {
+        GDALRasterBandH ov = GDALGetOverview(GDALGetRasterBand(out.outh[z - out.start], tc + b + 1), level - 1);
+        if (!ov || CE_None != GDALRasterIOEx(ov, GF_Write, tx * cube.pszx, ty * cube.psz, w, h,
+            const_cast<char *>(tile + b * band), w, h, cube.dt, pix, line, nullptr))
+            return false;
+    }
+    return true;
+}
+
+// Adds a written cublock to the overviews of its slices, the complete overview tiles are written
+// Empty cublocks add the fill value. Slices are in parallel when writing directly
+static CPLErr OverviewCublock(const Cube &cube, const OutputGroup &out, Cublock &cb) {
+    Overviews &ov = *cube.overviews;
+    int ax = cube.axes[0], ay = cube.axes[1], az = cube.axes[2], ac = cube.axes[3];
+    atomic<int> failed(0);
+    auto slice = [&](size_t k, int worker) {
+        Overviews::Sink sink = [&](int level, int tx, int ty, int z, int tc, const char *tile, int w, int h,
+            GSpacing pix, GSpacing line, GSpacing band)
+        {
+            if (!cube.writer)
+                return WriteOverviewTile(cube, out, level, tx, ty, z, tc, tile, w, h, pix, line, band);
+            return CE_None == cube.writer->WriteTile(worker, tx, ty, z, tc, tile, w, h, pix, line, band,
+                nullptr, level);
+        };
+        int z = Start(cb, az) + static_cast<int>(k);
+        for (int c = 0; !failed && c < Extent(cb, ac); c++) {
+            bool ok = cb.empty
+                ? ov.AddFill(z, Start(cb, ac) + c, Start(cb, ax), Start(cb, ay), Extent(cb, ax), Extent(cb, ay), sink)
+                : ov.Add(z, Start(cb, ac) + c, Start(cb, ax), Start(cb, ay),
+                    cb.outbuffer + k * cube.oslice_stride + c * cube.oband_stride, Extent(cb, ax), Extent(cb, ay),
+                    cube.opix_stride, cube.oline_stride, sink);
+            if (!ok)
+                failed = 1;
+        }
+    };
+    if (cube.pool)
+        cube.pool->Run(Extent(cb, az), slice);
+    else
+        for (int k = 0; k < Extent(cb, az); k++)
+            slice(k, 0);
+    if (failed)
+        CPLError(CE_Failure, CPLE_AppDefined, "Can't write the overviews of slice %d", Start(cb, az));
+    return failed ? CE_Failure : CE_None;
+}
+
+// Called in loop order, switches the output group when needed
+static CPLErr EmitCublock(const Cube &cube, OutputGroup &out, Cublock &cb) {
+    Stats &st = *cube.stats;
+    int s0 = Start(cb, cube.axes[2]);
+    if (!cube.writer && out.start != s0) {
+        // GDAL writes are on disk once the slices are closed, the whole group is done
+        if (out.start >= 0) {
+            StageTimer t;
+            out.Close();
+            st.Add(PH_CLOSE, t.Seconds());
+            cube.journal->Mark(cb.seq);
+        }
+        StageTimer t;
+        bool ok = out.Open(cube, s0);
+        st.Add(PH_OPEN, t.Seconds(), cb.seq);
+        if (!ok)
+            return CE_Failure;
+    }
+
+    // The output tiles of an empty cublock stay empty
+    StageTimer t;
+    uint64_t written = 0;
+    CPLErr err = CE_None;
+    if (cb.empty)
+        st.Skip();
+    else if (cube.writer)
+        err = WriteCublockDirect(cube, cb, written);
+    else {
+        err = WriteCublock(cube, out, cb);
+        written = OutTiles(cube, cb).Count();
+    }
+    if (err == CE_None && cube.overviews)
+        err = OverviewCublock(cube, out, cb);
+    st.Add(PH_WRITE, t.Seconds(), cb.seq);
+    if (err != CE_None)
+        return err;
+
+    // Pixel interleaved tiles hold all the bands
+    uint64_t ntx = (cb.dx + cube.pszx - 1) / cube.pszx;
+    uint64_t nty = (cb.dy + cube.pszy - 1) / cube.pszy;
+    uint64_t ntc = cube.iinterleaved ? 1 : cb.dc;
+    st.Count(static_cast<uint64_t>(cb.dx) * cb.dy * cb.dz * cb.dc * cube.dtsz,
+        cb.empty ? 0 : ntx * nty * cb.dz * ntc, written);
+    st.Done(cb.seq);
+    // The reductions of a strip are complete with its slice group
+    bool groupend = (cb.seq + 1) % GroupCount(cube) == 0 || cb.seq + 1 == CublockCount(cube);
+    if (cube.reductions && groupend) {
+        StageTimer tr;
+        bool ok = cube.reductions->Finish(s0, cube.reduceh);
+        st.Add(PH_WRITE, tr.Seconds());
+        if (!ok) {
+            CPLError(CE_Failure, CPLE_FileIO, "Can't write the reductions from %d", s0);
+            return CE_Failure;
+        }
+    }
+    // Direct writes are complete when the tiles are stored, and the statistics when the group is
+    if (cube.writer) {
+        if (cube.bandstats && groupend) {
+            StageTimer tc;
+            bool ok = ApplyBandStats(cube, s0);
+            st.Add(PH_CLOSE, tc.Seconds());
+            if (!ok)
+                return CE_Failure;
+        }
+        cube.journal->Mark(cb.seq + 1);
+    }
+    return CE_None;
+}
+
+// Buffer strides for the current cublock geometry
+static void SetStrides(Cube &cube) {
+    // These are the input strides
+    cube.pix_stride = cube.dtsz;
+    cube.line_stride = cube.xblk * cube.pix_stride;
+    cube.z_stride = cube.yblk * cube.line_stride;
+    cube.band_stride = cube.zdepth * cube.z_stride;
+
+    // And the output ones, from the cublock size along the output axes
+    GSpacing bx = Block(cube, cube.axes[0]), by = Block(cube, cube.axes[1]), bc = Block(cube, cube.axes[3]);
+    if (cube.interleaved) {
+        cube.opix_stride = bc * cube.dtsz;
+        cube.oline_stride = bx * cube.opix_stride;
+        cube.oband_stride = cube.dtsz;
+        cube.oslice_stride = by * cube.oline_stride;
+    }
+    else {
+        cube.opix_stride = cube.dtsz;
+        cube.oline_stride = bx * cube.opix_stride;
+        cube.oband_stride = by * cube.oline_stride;
+        cube.oslice_stride = bc * cube.oband_stride;
+    }
+
+    // Operating on a block of size
+    cube.BSZ = static_cast<size_t>(cube.cband) * cube.zdepth * cube.yblk * cube.xblk * cube.dtsz;
+}
+
+// Picks the cublock geometry to fit nslots pairs of buffers and the GDAL cache in budget bytes
+// All the bands first, up to maxbands, so interleaved tiles are read once, then the output
+// Y axis for larger writes, then the output X axis. When swapping Y and Z, that is Z depth then width
+// Reading through GDAL, the block cache needs room for the tiles of every reader
+static bool PlanCube(Cube &cube, size_t budget, int nslots, int nreaders, int maxbands) {
+    // Bands are counted one by one, at least cmin of them
+    size_t cmin = Unit(cube, AX_C);
+    size_t unit = static_cast<size_t>(Unit(cube, AX_X)) * Unit(cube, AX_Y) * Unit(cube, AX_Z) * cube.dtsz;
+    size_t cf = 2 + (cube.reader ? 0 : nreaders);
+    size_t k = budget / (unit * (2 * nslots + cf));
+    if (k < cmin) {
+        CPLError(CE_Failure, CPLE_AppDefined, "Memory budget is too small, need at least %llu MiB",
+            static_cast<unsigned long long>((unit * (2 * nslots + cf) * cmin) >> 20) + 1);
+        return false;
+    }
+
+    size_t nb = max(cmin, min(static_cast<size_t>(maxbands), k) / cmin * cmin);
+    size_t mult[4] = { 1, 1, 1, 1 };
+    size_t used = nb;
+    const int grow[2] = { cube.axes[1], cube.axes[0] };
+    for (int a : grow) {
+        if (a == AX_C)
+            continue;
+        size_t pages = (Size(cube, a) + Unit(cube, a) - 1) / Unit(cube, a);
+        mult[a] = max(size_t(1), min(pages, k / used));
+        used *= mult[a];
+    }
+    cube.cband = static_cast<int>(nb);
+    cube.xblk = min(cube.xsz, static_cast<int>(mult[AX_X]) * Unit(cube, AX_X));
+    cube.yblk = min(cube.ysz, static_cast<int>(mult[AX_Y]) * Unit(cube, AX_Y));
+    cube.zdepth = min(cube.zsz, static_cast<int>(mult[AX_Z]) * Unit(cube, AX_Z));
+    SetStrides(cube);
+
+    GIntBig cache = static_cast<GIntBig>(budget - 2 * nslots * cube.BSZ);
+    GDALSetCacheMax64(cache);
+
+    cout << "Plan: " << cube.cband << " of " << cube.csz << " bands, Z depth " << cube.zdepth
+        << ", Y height " << cube.yblk << ", X width " << cube.xblk << ", " << nslots << " pairs of "
+        << (cube.BSZ >> 20) << " MiB buffers, " << (cache >> 20) << " MiB GDAL cache" << endl;
+    return true;
+}
+
+// Checks the output index records of the first n cublocks, the tiles have to be in the data file
+// Returns how many cublocks can be kept, up to the output slice group of the first bad one
+static size_t VerifyOutput(const Cube &cube, size_t n, uint64_t &ntiles) {
+    MRFInfo info;
+    RawFile idx, data;
+    MappedFile map;
+    ntiles = 0;
+    if (!info.Parse(cube.TargetName.c_str())
+        || info.xsz != cube.osz[0] || info.ysz != cube.osz[1] || info.zsz != cube.osz[2] || info.csz != cube.osz[3]
+        || info.pszx != cube.pszx || info.pszy != cube.psz
+        || !idx.Open(info.idxfname) || !data.Open(info.datafname)
+        || idx.Size() < info.IdxSize() || !map.Map(idx, info.IdxSize()))
+        return 0;
+
+    uint64_t dsz = data.Size();
+    size_t group = GroupCount(cube);
+    int ax = cube.axes[0], ay = cube.axes[1], az = cube.axes[2], ac = cube.axes[3];
+    Cublock cb;
+    for (size_t seq = 0; seq < n; seq++) {
+        Locate(cube, seq, cb);
+        OutTiles tiles(cube, cb);
+        for (size_t i = 0; i < tiles.Count(); i++) {
+            int x0, y0, k, c;
+            tiles.Get(i, x0, y0, k, c);
+            const char *rec = map.Data() + info.IdxOffset((Start(cb, ax) + x0) / info.pszx,
+                (Start(cb, ay) + y0) / info.pszy, Start(cb, az) + k, info.Interleaved() ? 0 : Start(cb, ac) + c);
+            uint64_t size = GetBE64(rec + sizeof(uint64_t));
+            if (size && GetBE64(rec) + size > dsz)
+                return seq - seq % group;
+            if (size)
+                ntiles++;
+        }
+    }
+    return n;
+}
+
+// Parses the --overviews value, the levels as gdaladdo takes them
+// MRF overviews have a uniform scale, so each level has to be the previous one times the first
+static bool ParseOverviews(const char *s, int &scale) {
+    CPLStringList levels(CSLTokenizeString2(s, ",", 0));
+    scale = 0;
+    int expect = 0;
+    for (int i = 0; i < levels.Count(); i++) {
+        int v = atoi(levels[i]);
+        if (!scale) {
+            scale = expect = v;
+            if (scale < 2)
+                return false;
+        }
+        if (v != expect)
+            return false;
+        expect *= scale;
+    }
+    return scale > 1;
+}
+
+// Reading, Loop over y, z and x. Start refers to input, end refers to output
+// With prefetch, a reader thread keeps up to that many cublocks read ahead, so the reads
+// overlap the transpose and the writes done by this thread
+static int RunSequential(const Cube &cube, int prefetch) {
+    size_t nbufs = static_cast<size_t>(prefetch) + 1;
+    vector<Cublock> blocks(nbufs);
+    BoundedQueue<Cublock *> freeq(nbufs), readq(nbufs);
+    int ret = 0;
+    for (auto &cb : blocks) {
+        cb.buffer = cube.arena->Get(cube.BSZ);
+        cb.outbuffer = cube.arena->Get(cube.BSZ);
+        if (!cb.buffer || !cb.outbuffer)
+            ret = 3;
+        freeq.push(&cb);
+    }
+
+    if (ret) {
+        for (auto &cb : blocks) {
+            cube.arena->Release(cb.buffer);
+            cube.arena->Release(cb.outbuffer);
+        }
+        return Usage(CPLOPrintf("Failed to allocate %d buffers of size %llu",
+            static_cast<int>(nbufs * 2), static_cast<unsigned long long>(cube.BSZ)), 3);
+    }
+
+    size_t nblocks = CublockCount(cube);
+    atomic<int> failed(0);
+    InputGroup in;
+    OutputGroup out;
+
+    // In sequence, same as the writes
+    auto reader = [&]() {
+        Cublock *cb;
+        for (size_t seq = cube.first; seq < nblocks && !failed && freeq.pop(cb); seq++) {
+            Locate(cube, seq, *cb);
+            if (CE_None != FetchCublock(cube, in, *cb))
+                failed = 4;
+            readq.push(cb);
+        }
+        StageTimer t;
+        in.Close();
+        cube.stats->Add(PH_CLOSE, t.Seconds());
+        readq.close();
+    };
+
+    auto writer = [&]() {
+        Cublock *cb;
+        while (readq.pop(cb)) {
+            if (!failed) {
+                TransposeCublock(cube, *cb);
+                if (CE_None != EmitCublock(cube, out, *cb))
+                    failed = 5;
+            }
+            freeq.push(cb);
+        }
+    };
+
+    if (prefetch > 0) {
+        thread t(reader);
+        writer();
+        t.join();
+    }
+    else {
+        // One buffer, each cublock is read, then written
+        for (size_t seq = cube.first; seq < nblocks && !failed; seq++) {
+            Cublock &cb = blocks[0];
+            Locate(cube, seq, cb);
+            if (CE_None != FetchCublock(cube, in, cb))
+                failed = 4;
+            else {
+                TransposeCublock(cube, cb);
+                if (CE_None != EmitCublock(cube, out, cb))
+                    failed = 5;
+            }
+        }
+        StageTimer t;
+        in.Close();
+        cube.stats->Add(PH_CLOSE, t.Seconds());
+    }
+
+    StageTimer t;
+    out.Close();
+    cube.stats->Add(PH_CLOSE, t.Seconds());
+    for (auto &cb : blocks) {
+        cube.arena->Release(cb.buffer);
+        cube.arena->Release(cb.outbuffer);
+    }
+    return failed;
+}
+
+// Reader threads -> transposer -> writer (this thread), on different cublocks
+// Writes stay on one thread, all output slices share the data and index files
+static int RunPipeline(const Cube &cube, int nthreads) {
+    size_t nblocks = CublockCount(cube);
+    // Enough buffers to keep every stage busy
+    size_t nbufs = 2 * nthreads + 2;
+    vector<Cublock> blocks(nbufs);
+    BoundedQueue<Cublock *> freeq(nbufs), readq(nbufs), writeq(nbufs);
+    int ret = 0;
+    for (auto &cb : blocks) {
+        cb.buffer = cube.arena->Get(cube.BSZ);
+        cb.outbuffer = cube.arena->Get(cube.BSZ);
+        if (!cb.buffer || !cb.outbuffer)
+            ret = 3;
+        freeq.push(&cb);
+    }
+
+    if (ret) {
+        for (auto &cb : blocks) {
+            cube.arena->Release(cb.buffer);
+            cube.arena->Release(cb.outbuffer);
+        }
+        return Usage(CPLOPrintf("Failed to allocate %d buffers of size %llu",
+            static_cast<int>(nbufs * 2), static_cast<unsigned long long>(cube.BSZ)), 3);
+    }
+
+    atomic<size_t> next(cube.first);
+    atomic<int> failed(0);
+    atomic<int> active(nthreads);
+
+    // Each reader owns its input datasets, so reads don't share GDAL handles
+    // A buffer is taken before the sequence number, the writer can't starve
+    auto reader = [&]() {
+        InputGroup in;
+        Cublock *cb;
+        while (freeq.pop(cb)) {
+            size_t seq = failed ? nblocks : next++;
+            if (seq >= nblocks) {
+                freeq.push(cb);
+                break;
+            }
+            Locate(cube, seq, *cb);
+            if (CE_None != FetchCublock(cube, in, *cb))
+                failed = 4;
+            readq.push(cb);
+        }
+        StageTimer t;
+        in.Close();
+        cube.stats->Add(PH_CLOSE, t.Seconds());
+        if (--active == 0)
+            readq.close();
+    };
+
+    auto transposer = [&]() {
+        Cublock *cb;
+        while (readq.pop(cb)) {
+            if (!failed)
+                TransposeCublock(cube, *cb);
+            writeq.push(cb);
+        }
+        writeq.close();
+    };
+
+    vector<thread> threads;
+    for (int i = 0; i < nthreads; i++)
+        threads.emplace_back(reader);
+    threads.emplace_back(transposer);
+
+    // Cublocks arrive out of order, the output groups are opened in sequence
+    OutputGroup out;
+    map<size_t, Cublock *> pending;
+    size_t expected = cube.first;
+    Cublock *cb;
+    while (writeq.pop(cb)) {
+        pending[cb->seq] = cb;
+        while (!pending.empty() && pending.begin()->first == expected) {
+            cb = pending.begin()->second;
+            pending.erase(pending.begin());
+            if (!failed && CE_None != EmitCublock(cube, out, *cb))
+                failed = 5;
+            freeq.push(cb);
+            expected++;
+        }
+    }
+    // Only after a failure
+    for (auto &it : pending)
+        freeq.push(it.second);
+
+    for (auto &t : threads)
+        t.join();
+    StageTimer t;
+    out.Close();
+    cube.stats->Add(PH_CLOSE, t.Seconds());
+
+    for (auto &b : blocks) {
+        cube.arena->Release(b.buffer);
+        cube.arena->Release(b.outbuffer);
+    }
+    return failed;
+}
+
 int main(int argc, char **argv) {
     bool verbose = false;
     // Preserve the input geoprojection
     bool geo = false;
     int psz = 0; // No default
+    int nthreads = 0; // Sequential
+    int bgroup = 0; // All bands
+    size_t budget = 0; // In bytes, none
+    const char *statsname = nullptr;
+    bool resume = false;
+    int axes[4] = { AX_X, AX_Z, AX_Y, AX_C }; // Swap Y and Z
+    int part = 0, nparts = 0; // All slices
+    int ylo = -1, yhi = -1;
+    int appendz = -1;
+    CPLStringList extraopt;
+    bool computestats = false, hist = false, dedupe = false;
+    int ovscale = 0;
+    bool ovaverage = true;
+    const char *reducespec = nullptr;
+    vector<Reductions::Reduction> reductions;
     GDALAllRegister();
 
     GDALDriverH d_mrf = GDALGetDriverByName("MRF");
@@ -39,11 +1084,86 @@ int main(int argc, char **argv) {
     if (nArgc < 1)
         exit(-nArgc);
 
+    // The parts become one MRF
+    if (nArgc > 1 && EQUAL(argv[1], "merge")) {
+        for (int iArg = 2; iArg < nArgc; iArg++) {
+            if (EQUAL(argv[iArg], "-v"))
+                verbose = true;
+            else
+                fnames.push_back(argv[iArg]);
+        }
+        if (fnames.size() < 2)
+            return Usage();
+        return MergeParts(fnames[0].c_str(), vector<string>(fnames.begin() + 1, fnames.end()), verbose);
+    }
+
     for (int iArg = 1; iArg < nArgc; iArg++)
     {
         if (EQUAL(argv[iArg], "-z")) {
             psz = atoi(argv[++iArg]);
         }
+        else if (EQUAL(argv[iArg], "-j") && iArg < nArgc - 1) {
+            if (!ParseCount(argv[++iArg], 0, nthreads))
+                return Usage(CPLOPrintf("Invalid thread count %s", argv[iArg]));
+        }
+        else if (EQUAL(argv[iArg], "-m") && iArg < nArgc - 1) {
+            if (!ParseMiB(argv[++iArg], budget))
+                return Usage(CPLOPrintf("Invalid memory size %s", argv[iArg]));
+        }
+        else if (EQUAL(argv[iArg], "-b") && iArg < nArgc - 1) {
+            bgroup = atoi(argv[++iArg]);
+        }
+        else if (EQUAL(argv[iArg], "--stats") && iArg < nArgc - 1) {
+            statsname = argv[++iArg];
+        }
+        else if (EQUAL(argv[iArg], "--resume")) {
+            resume = true;
+        }
+        else if (EQUAL(argv[iArg], "--axes") && iArg < nArgc - 1) {
+            if (!ParseAxes(argv[++iArg], axes))
+                return Usage(CPLOPrintf("Invalid axes %s", argv[iArg]));
+        }
+        else if (EQUAL(argv[iArg], "--part") && iArg < nArgc - 1) {
+            if (2 != sscanf(argv[++iArg], "%d/%d", &part, &nparts) || nparts < 1 || part < 1 || part > nparts)
+                return Usage(CPLOPrintf("Invalid part %s", argv[iArg]));
+        }
+        else if (EQUAL(argv[iArg], "--ylines") && iArg < nArgc - 1) {
+            if (2 != sscanf(argv[++iArg], "%d:%d", &ylo, &yhi) || ylo < 0 || yhi <= ylo)
+                return Usage(CPLOPrintf("Invalid line range %s", argv[iArg]));
+        }
+        else if (EQUAL(argv[iArg], "-co") && iArg < nArgc - 1) {
+            extraopt.AddString(argv[++iArg]);
+        }
+        else if (EQUAL(argv[iArg], "--append-from") && iArg < nArgc - 1) {
+            appendz = atoi(argv[++iArg]);
+            if (appendz < 0)
+                return Usage(CPLOPrintf("Invalid append start %s", argv[iArg]));
+        }
+        else if (EQUAL(argv[iArg], "--compute-stats")) {
+            computestats = true;
+        }
+        else if (EQUAL(argv[iArg], "--hist")) {
+            computestats = hist = true;
+        }
+        else if (EQUAL(argv[iArg], "--overviews") && iArg < nArgc - 1) {
+            if (!ParseOverviews(argv[++iArg], ovscale))
+                return Usage(CPLOPrintf("Invalid overview list %s", argv[iArg]));
+        }
+        else if (EQUAL(argv[iArg], "-r") && iArg < nArgc - 1) {
+            iArg++;
+            if (EQUAL(argv[iArg], "nearest"))
+                ovaverage = false;
+            else if (!EQUAL(argv[iArg], "average") && !EQUAL(argv[iArg], "avg"))
+                return Usage(CPLOPrintf("Unknown resampling %s", argv[iArg]));
+        }
+        else if (EQUAL(argv[iArg], "--dedupe")) {
+            dedupe = true;
+        }
+        else if (EQUAL(argv[iArg], "--reduce") && iArg < nArgc - 1) {
+            reducespec = argv[++iArg];
+            if (!Reductions::Parse(reducespec, reductions))
+                return Usage(CPLOPrintf("Invalid reduction list %s", reducespec));
+        }
         else if (EQUAL(argv[iArg], "-v")) {
             verbose = true;
         }
@@ -53,53 +1173,82 @@ int main(int argc, char **argv) {
             fnames.push_back(argv[iArg]);
     }
 
-    if (fnames.size() != 2)
+    if (fnames.size() != 2 || (nparts && ylo >= 0) || (appendz >= 0 && (nparts || ylo >= 0)))
         return Usage();
+    // Every reduction needs all of Z, and a strip all the pixels across
+    if (reducespec && (nparts || ylo >= 0 || appendz >= 0))
+        return Usage("Reductions need the whole input, they can't be combined with --part, --ylines or --append-from");
+    if (reducespec && axes[2] != AX_X && axes[2] != AX_Y)
+        return Usage("Reductions need the output slices along the input x or y");
 
     string SourceName(fnames[0]), TargetName(fnames[1]);
 
+    // A list of 2D rasters is described by the first one
+    vector<string> slicefiles;
+    bool listed = IsSliceList(SourceName.c_str());
+    if (listed && !ReadSliceList(SourceName.c_str(), slicefiles))
+        return Usage(CPLOPrintf("No input rasters in %s", SourceName.c_str()), 2);
+
     CPLPushErrorHandler(CPLQuietErrorHandler);
-    GDALDatasetH hDatasetin = GDALOpen(SourceName.c_str(), GA_ReadOnly);
+    GDALDatasetH hDatasetin = GDALOpen(listed ? slicefiles[0].c_str() : SourceName.c_str(), GA_ReadOnly);
     CPLPopErrorHandler();
 
     if (hDatasetin == NULL) {
-        CPLError(CE_Failure, CPLE_AppDefined, "Can't open source file %s for reading", SourceName.c_str());
+        CPLError(CE_Failure, CPLE_AppDefined, "Can't open source file %s for reading",
+            listed ? slicefiles[0].c_str() : SourceName.c_str());
         return 0;
     }
 
-    if (!EQUAL(GDALGetDriverShortName(GDALGetDatasetDriver(hDatasetin)), "MRF"))
+    if (!listed && !EQUAL(GDALGetDriverShortName(GDALGetDatasetDriver(hDatasetin)), "MRF"))
         return Usage("Input file is not MRF", 2);
 
     double gt[6] = {0, 0, 0, 0, 0, 0};
     CPLString projection(GDALGetProjectionRef(hDatasetin));
     char **md = GDALGetMetadata(hDatasetin, "IMAGE_STRUCTURE");
-    if (!CSLFetchNameValue(md, "ZSIZE"))
+    const char *interleave = CSLFetchNameValue(md, "INTERLEAVE");
+    bool interleaved = interleave && EQUAL(interleave, "PIXEL");
+    if (!listed && !CSLFetchNameValue(md, "ZSIZE"))
         return Usage("Source is not a 3-rd dimension MRF", 2);
-    int zsz = atoi(CSLFetchNameValue(md, "ZSIZE"));
+    int zsz = listed ? static_cast<int>(slicefiles.size()) : atoi(CSLFetchNameValue(md, "ZSIZE"));
     int csz = GDALGetRasterCount(hDatasetin);
     GDALRasterBandH b1 = GDALGetRasterBand(hDatasetin, 1);
     int xsz = GDALGetRasterBandXSize(b1);
     int ysz = GDALGetRasterBandYSize(b1);
 
+    // Output size
+    const int isz[4] = { xsz, ysz, zsz, csz };
+    int osz[4];
+    for (int i = 0; i < 4; i++)
+        osz[i] = isz[axes[i]];
+
     // Get the source geotransform and convert it for the output, preserving the area
-    GDALGetGeoTransform(hDatasetin, gt);
-    // gt[5] is the new y resolution, should be adjusted based on the new Y dimension
-    gt[5] *= double(ysz) / double(zsz);
+    // The reductions are on the input grid, they keep it
+    bool hasgt = CE_None == GDALGetGeoTransform(hDatasetin, gt);
+    double igt[6];
+    memcpy(igt, gt, sizeof(gt));
+    // gt[1] and gt[5] are the new resolutions, adjusted based on the new X and Y dimensions
+    gt[1] *= double(xsz) / double(osz[0]);
+    gt[5] *= double(ysz) / double(osz[1]);
 
     // The NoData and Min-Max should be done per band instead of the current solution
     int bHasNoData = false;
     double nd = GDALGetRasterNoDataValue(b1, &bHasNoData);
     int bHasStats = false;
 
-    // Get Stats if present
+    // Get Stats if present, the ones of the first listed raster don't apply to the others
     double min_v, max_v, mean_v, stdd_v;
-    bHasStats = (CE_None == GDALGetRasterStatistics(b1, TRUE, FALSE, &min_v, &max_v, &mean_v, &stdd_v));
+    bHasStats = !listed && (CE_None == GDALGetRasterStatistics(b1, TRUE, FALSE, &min_v, &max_v, &mean_v, &stdd_v));
 
     int pszx, pszy;
     GDALGetBlockSize(b1, &pszx, &pszy);
+    // 2D rasters are often striped, square pages are read instead, also the output page size
+    if (listed)
+        pszx = pszy = psz ? psz : 512;
 
     GDALDataType dt = GDALGetRasterDataType(b1);
     int dtsz = GDALGetDataTypeSizeBytes(dt);
+    if (reducespec && !BandStats::Supported(dt))
+        return Usage(CPLOPrintf("No reductions of %s data", GDALGetDataTypeName(dt)), 2);
 
     // Checks and adjustments
     if (!psz)
@@ -108,6 +1257,12 @@ int main(int argc, char **argv) {
     char **copt = NULL;
     char **freeopt = NULL;
 
+    // Other formats have different options, only the interleave carries over
+    if (listed) {
+        md = nullptr;
+        if (interleaved)
+            copt = CSLSetNameValue(copt, "INTERLEAVE", "PIXEL");
+    }
     while (md && *md) {
 //        cout << *md << endl;
         if (STARTS_WITH_CI(*md, "COMPRESSION=")) {
@@ -116,6 +1271,7 @@ int main(int argc, char **argv) {
         else if (STARTS_WITH_CI(*md, "ZSLICE=")
             || STARTS_WITH_CI(*md, "ZSIZE=")
             || STARTS_WITH_CI(*md, "V2=")
+            || STARTS_WITH_CI(*md, "UNIFORM_SCALE=")
             )
         {
             // Removed, modified or ignored
@@ -152,7 +1308,23 @@ int main(int argc, char **argv) {
     // Add the known options
     copt = CSLAppendPrintf(copt, "BLOCKXSIZE=%d", pszx);
     copt = CSLAppendPrintf(copt, "BLOCKYSIZE=%d", psz);
-    copt = CSLAppendPrintf(copt, "ZSIZE=%d", ysz);
+    copt = CSLAppendPrintf(copt, "ZSIZE=%d", osz[2]);
+    for (int i = 0; i < extraopt.Count(); i++) {
+        char *key = nullptr;
+        const char *value = CPLParseNameValue(extraopt[i], &key);
+        if (key && value)
+            copt = CSLSetNameValue(copt, key, value);
+        CPLFree(key);
+    }
+    // The output interleave can be changed by -co, the input one is from the input
+    const char *ointerleave = CSLFetchNameValue(copt, "INTERLEAVE");
+    bool ointerleaved = ointerleave && EQUAL(ointerleave, "PIXEL");
+    if (ovscale) {
+        // Every overview level averages whole blocks, which have to be within a page
+        if (pszx % ovscale || psz % ovscale)
+            return Usage(CPLOPrintf("The page size has to be a multiple of the overview scale %d", ovscale));
+        copt = CSLAppendPrintf(copt, "UNIFORM_SCALE=%d", ovscale);
+    }
 
     if (verbose) {
         md = copt;
@@ -164,105 +1336,387 @@ int main(int argc, char **argv) {
 
     GDALClose(hDatasetin);
 
-    // Operating on a block of size
-    size_t BSZ = static_cast<size_t>(csz) * psz * pszy * pszx * dtsz;
+    // Read the input tiles directly if possible, YZZY_DIRECT_READ=NO forces GDAL reads
+    // The input index is also used to skip empty cublocks, when reading through GDAL
+    MRFReader reader;
+    bool indexed = !listed && reader.Open(SourceName.c_str());
+    if (indexed && (reader.xsz != xsz || reader.ysz != ysz || reader.zsz != zsz || reader.csz != csz
+        || reader.pszx != pszx || reader.pszy != pszy || reader.dt != dt))
+    {
+        if (verbose)
+            cout << "Reading through GDAL, MRF metadata mismatch" << endl;
+        indexed = false;
+    }
+    bool direct = indexed && CPLTestBool(CPLGetConfigOption("YZZY_DIRECT_READ", "YES"));
+    if (direct && !reader.IsSupported()) {
+        if (verbose)
+            cout << "Reading through GDAL, " << reader.Reason() << endl;
+        direct = false;
+    }
+    indexed = indexed && reader.IndexUsable();
+    if (direct) {
+        reader.SetFill(bHasNoData ? nd : 0.0);
+        // Per reader thread, a cublock has many tiles
+        reader.SetQueueDepth(static_cast<unsigned>(atoi(CPLGetConfigOption("YZZY_READ_QUEUE_DEPTH", "64"))));
+        if (verbose)
+            cout << "Reading tiles directly from " << reader.datafname << endl;
+    }
+    else if (!indexed)
+        reader.Close();
 
-    // These are the input strides
-    int pix_stride = dtsz;
-    int line_stride = pszx * pix_stride;
-    int z_stride = pszy * line_stride;
-    int band_stride = psz * z_stride;
+    Cube cube;
+    cube.SourceName = SourceName;
+    cube.TargetName = TargetName;
+    cube.slices = slicefiles;
+    if (verbose && listed)
+        cout << "Reading " << slicefiles.size() << " rasters as Z slices, from " << slicefiles[0] << endl;
+    cube.xsz = xsz;
+    cube.ysz = ysz;
+    cube.zsz = zsz;
+    cube.csz = csz;
+    cube.pszx = pszx;
+    cube.pszy = pszy;
+    cube.psz = psz;
+    cube.dt = dt;
+    cube.dtsz = dtsz;
+
+    memcpy(cube.axes, axes, sizeof(axes));
+    memcpy(cube.osz, osz, sizeof(osz));
+    cube.iinterleaved = interleaved && csz > 1;
+    cube.interleaved = ointerleaved && osz[3] > 1;
+
+    // Parts are whole input pages along the output slice axis, so they don't share input tiles
+    int sunit = Unit(cube, axes[2]);
+    int nunits = (osz[2] + sunit - 1) / sunit;
+    cube.slo = 0;
+    cube.shi = osz[2];
+    if (nparts) {
+        if (nparts > nunits)
+            return Usage(CPLOPrintf("Can't split %d slices in %d parts of %d", osz[2], nparts, sunit));
+        cube.slo = static_cast<int>(static_cast<int64_t>(part - 1) * nunits / nparts) * sunit;
+        cube.shi = min(osz[2], static_cast<int>(static_cast<int64_t>(part) * nunits / nparts) * sunit);
+    }
+    if (ylo >= 0) {
+        if (yhi > osz[2] || ylo % sunit || (yhi % sunit && yhi != osz[2]))
+            return Usage(CPLOPrintf("Line range has to be within %d, in multiples of %d", osz[2], sunit));
+        cube.slo = ylo;
+        cube.shi = yhi;
+    }
+    if (cube.slo != 0 || cube.shi != osz[2])
+        cout << "Output Z slices " << cube.slo << " to " << cube.shi - 1 << " of " << osz[2] << endl;
+
+    // Appending starts at a whole output page, the partial last page of the output is rewritten
+    // The rest of the output has to be there already, same as the input
+    cube.zlo = 0;
+    int zaxis = 0;
+    while (axes[zaxis] != AX_Z)
+        zaxis++;
+    if (appendz >= 0) {
+        MRFInfo prev;
+        if (!prev.Parse(TargetName.c_str()))
+            return Usage(CPLOPrintf("Can't append to %s, it is not an MRF", TargetName.c_str()), 2);
+        int psize[3] = { prev.xsz, prev.ysz, prev.zsz };
+        if (zaxis == 3)
+            return Usage("Can't append input Z slices that become output bands", 2);
+        if (prev.csz != osz[3] || prev.dt != dt || prev.pszx != pszx || prev.pszy != psz
+            || (zaxis != 0 && prev.xsz != osz[0]) || (zaxis != 1 && prev.ysz != osz[1]) || (zaxis != 2 && prev.zsz != osz[2]))
+            return Usage(CPLOPrintf("%s doesn't match the input", TargetName.c_str()), 2);
+        if (appendz > psize[zaxis] || appendz >= zsz)
+            return Usage(CPLOPrintf("Can't append from %d, the output has %d and the input %d", appendz,
+                psize[zaxis], zsz), 2);
+        if (zaxis != 2 && (computestats || ovscale))
+            return Usage("Statistics and overviews need whole output slices, they can't be appended", 2);
+        cube.zlo = appendz - appendz % Unit(cube, AX_Z);
+        if (zaxis == 2)
+            cube.slo = cube.zlo;
+        cout << "Appending input Z slices " << cube.zlo << " to " << zsz - 1 << endl;
+    }
+
+    // One page in each direction, all bands, unless planned
+    // Band groups are separate passes when the input is band separate, otherwise
+    // they share a pass, so each input tile is decoded once
+    // The output tiles of a pixel interleaved MRF also need all the bands
+    if (bgroup <= 0 || bgroup > csz)
+        bgroup = csz;
+    cube.zdepth = Unit(cube, AX_Z);
+    cube.yblk = Unit(cube, AX_Y);
+    cube.xblk = Unit(cube, AX_X);
+    int cunit = Unit(cube, AX_C);
+    cube.cband = interleaved ? csz : min(csz, (bgroup + cunit - 1) / cunit * cunit);
+    cube.cgroup = bgroup;
+    cube.gthreads = max(nthreads, 1);
+    SetStrides(cube);
+
+    // Huge pages cut the TLB misses of the transpose, YZZY_HUGE_PAGES=NO uses the heap
+    Arena arena(CPLTestBool(CPLGetConfigOption("YZZY_HUGE_PAGES", "YES")));
+    cube.arena = &arena;
+    cube.reader = direct ? &reader : nullptr;
+    cube.index = indexed ? &reader : nullptr;
+    cube.writer = nullptr;
+    cube.pool = nullptr;
+    // Input datasets kept open, shared by the readers
+    cube.maxopen = static_cast<size_t>(atoi(CPLGetConfigOption("YZZY_MAX_OPEN_INPUTS", "512")))
+        / max(nthreads, 1);
+    cube.d_mrf = d_mrf;
+    cube.copt = copt;
+    cube.bHasNoData = bHasNoData;
+    cube.nd = nd;
+    cube.bHasStats = bHasStats;
+    cube.min_v = min_v;
+    cube.max_v = max_v;
+    cube.mean_v = mean_v;
+    cube.stdd_v = stdd_v;
+    cube.geo = geo;
+    cube.projection = projection;
 
-    //char *outbuffer = reinterpret_cast<char *>(malloc(BSZ));
-    char *buffer  = reinterpret_cast<char *>(malloc(BSZ));
+    // Accumulated per output slice and band, complex data has none
+    BandStats bandstats;
+    if (computestats && !BandStats::Supported(dt))
+        CPLError(CE_Warning, CPLE_NotSupported, "No statistics for %s data", GDALGetDataTypeName(dt));
+    else if (computestats) {
+        if (hist && !BandStats::HistogramSupported(dt))
+            CPLError(CE_Warning, CPLE_NotSupported, "Histograms are only kept for 8 bit data");
+        bandstats.Init(osz[2], osz[3], dt, bHasNoData, nd, hist);
+    }
+    cube.bandstats = bandstats.IsActive() ? &bandstats : nullptr;
+
+    // Partial overview tiles, per output slice
+    Overviews overviews;
+    if (ovscale) {
+        if (ovaverage && GDALDataTypeIsComplex(dt))
+            CPLError(CE_Warning, CPLE_NotSupported, "Complex overviews use the nearest pixel");
+        overviews.Init(osz[0], osz[1], osz[2], osz[3], pszx, psz, cube.interleaved, dt, ovscale, ovaverage,
+            bHasNoData, nd);
+        if (verbose)
+            cout << "Building " << overviews.Levels() << " overview levels" << endl;
+    }
+    cube.overviews = overviews.IsActive() ? &overviews : nullptr;
+    memcpy(cube.gt, gt, sizeof(gt));
+
+    // Sequential runs still read ahead, on one thread, YZZY_PREFETCH=0 turns it off
+    int prefetch = max(0, atoi(CPLGetConfigOption("YZZY_PREFETCH", "1")));
+    int nslots = nthreads > 0 ? 2 * nthreads + 2 : 1 + prefetch;
+    // The direct write encoders keep a few output pages each, besides the cublock buffers
+    bool directwrite = CPLTestBool(CPLGetConfigOption("YZZY_DIRECT_WRITE", "YES"));
+    size_t opage = static_cast<size_t>(pszx) * psz * dtsz * (cube.interleaved ? osz[3] : 1);
+    size_t encbytes = directwrite ? static_cast<size_t>(max(nthreads, 1)) * MRFWriter::EncoderBytes(opage) : 0;
+    if (budget && encbytes >= budget)
+        return Usage(CPLOPrintf("Memory budget is too small, the encoders need %llu MiB",
+            static_cast<unsigned long long>(encbytes >> 20) + 1), 3);
+    if (budget && !PlanCube(cube, budget - encbytes, nslots, nthreads, cube.cband))
+        return 3;
+    cube.cgroup = min(cube.cgroup, cube.cband);
 
-    if (!buffer)
-        return Usage(CPLOPrintf("Failed to allocate buffer of size %llu", BSZ), 3);
+    // Strips are one cublock wide along the output slice axis, they are not in the memory budget
+    Reductions reduce;
+    if (reducespec) {
+        reduce.Init(reductions, axes[2], Block(cube, axes[2]), xsz, ysz, csz, dt, bHasNoData, nd);
+        if (verbose)
+            cout << "Reducing along Z in strips of " << Block(cube, axes[2]) << (axes[2] == AX_X ? " columns" : " lines")
+                << endl;
+    }
+    cube.reductions = reduce.IsActive() ? &reduce : nullptr;
+
+    if (verbose && cube.interleaved)
+        cout << "Interleaving with the " << TransposeKernelName() << " kernel" << endl;
     if (verbose)
-        cout << "Using an " << BSZ << " sized buffer\n";
+        cout << "Using " << nslots << " pairs of "
+            << cube.BSZ << " sized buffers\n";
 
-    // Reading, Loop over y, x, z and c.
-    // Start refers to input
-    // End refers to output
+    // The output index makes room for the appended slices, before anything is written
+    if (appendz >= 0 && !GrowOutput(TargetName.c_str(), zaxis, osz[zaxis]))
+        return 5;
+
+    // Progress is journaled for the same geometry, then checked against the output index
+    // Cublocks in the journal are skipped, the output is updated instead of created
+    size_t nblocks = CublockCount(cube);
+    Journal journal;
+    CPLString jname(TargetName + ".journal");
+    CPLString geometry;
+    geometry.Printf("size %d %d %d %d axes %d%d%d%d slices %d %d from %d page %d %d %d cublock %d %d %d %d type %s scale %d"
+        " reduce %s",
+        xsz, ysz, zsz, csz, axes[0], axes[1], axes[2], axes[3], cube.slo, cube.shi, cube.zlo, pszx, pszy, psz,
+        cube.xblk, cube.yblk, cube.zdepth, cube.cband, GDALGetDataTypeName(dt), ovscale,
+        reducespec ? reducespec : "none");
+    if (!journal.Open(jname, geometry, resume))
+        return Usage(CPLOPrintf("Can't write %s", jname.c_str()), 5);
+    size_t first = journal.Done();
+    if (first) {
+        uint64_t ntiles = 0;
+        first = VerifyOutput(cube, first, ntiles);
+        if (first < journal.Done()) {
+            cout << "Output check failed after " << first << " cublocks" << endl;
+            journal.Mark(first);
+        }
+        // The statistics, the overviews and the reductions of a slice group come from all its cublocks
+        if (cube.bandstats || cube.overviews || cube.reductions)
+            first -= first % GroupCount(cube);
+        if (!first && !journal.Open(jname, geometry, false))
+            return Usage(CPLOPrintf("Can't write %s", jname.c_str()), 5);
+        if (first)
+            cout << "Resuming after " << first << " of " << nblocks << " cublocks, "
+                << ntiles << " output tiles checked" << endl;
+    }
+    else if (resume) {
+        cout << "No usable progress in " << jname << ", starting over" << endl;
+    }
+    cube.journal = &journal;
+    cube.first = first;
+    cube.resume = first > 0 || appendz >= 0;
 
-    for (int startz = 0; startz < zsz; startz += psz) {
-        int dz = min(psz, zsz - startz);
+    Stats stats;
+    cube.stats = &stats;
+    stats.Start(nblocks, first);
+    StageTimer tcreate;
 
-        vector<GDALDatasetH> inh(dz);
-        for (int z = 0; z < dz; z++) {
-            CPLString SName;
-            SName.Printf("%s:MRF:Z%d", SourceName.c_str(), startz + z);
-            GDALDatasetH  h = GDALOpen(SName, GA_ReadOnly);
-            inh[z] = h;
-        }
-
-        for (int starty = 0; starty < ysz; starty += pszy) {
-            int dy = min(pszy, ysz - starty);
-
-            vector<GDALDatasetH> outh(dy);
-            for (int z = 0; z < dy; z++) {
-                CPLString DName;
-                DName.Printf("%s:MRF:Z%d", TargetName.c_str(), starty + z);
-                GDALDatasetH h = GDALCreate(d_mrf, DName.c_str(), xsz, zsz, csz, dt, copt);
-                GDALRasterBandH b = GDALGetRasterBand(h, 1);
-                if (bHasNoData)
-                    GDALSetRasterNoDataValue(b, nd);
-                if (bHasStats)
-                    GDALSetRasterStatistics(b, min_v, max_v, mean_v, stdd_v);
-                if (geo) {
-                    GDALSetProjection(h, projection);
-                    GDALSetGeoTransform(h, gt);
-                }
-                outh[z] = h;
+    // Write the output tiles directly if possible, YZZY_DIRECT_WRITE=NO forces GDAL writes
+    // The output is created as a whole, the MRF metadata applies to all slices
+    MRFWriter writer;
+    ThreadPool pool(max(nthreads, 1));
+    if (directwrite) {
+        GDALDatasetH h = cube.resume ? nullptr : GDALCreate(d_mrf, TargetName.c_str(), osz[0], osz[1], osz[3], dt, copt);
+        if (!h && !cube.resume)
+            return Usage(CPLOPrintf("Can't create %s", TargetName.c_str()), 5);
+        if (h) {
+            if (bHasNoData)
+                GDALSetRasterNoDataValue(GDALGetRasterBand(h, 1), nd);
+            if (geo) {
+                GDALSetProjection(h, projection);
+                GDALSetGeoTransform(h, gt);
             }
+            GDALClose(h);
+        }
 
-            // This loop does a full cublock
-            for (int startx = 0; startx < xsz; startx += pszx) {
-                int dx = min(pszx, xsz - starty);
-                cout << "Processing " << startx << "," << starty << "," << startz << endl;
-                // fprintf(stderr, "Processing %d,%d,%d\n", startx, starty, startz);
-
-                // Read a cublock
-                for (int z = 0; z < dz; z++) {
-                    // Each one is considered a different dataset
-                    hDatasetin = inh[z];
-                    //fprintf(stderr,
-                    //    "Reading Z%d %d,%d - %d,%d %d stride %d %d %d\n",
-                    //    startz + z, startx, starty, dx, dy,
-                    //    z_stride * (z + startz), pix_stride, line_stride, band_stride
-                    //);
-                    GDALDatasetRasterIO(hDatasetin, GF_Read,
-                        startx, starty, dx, dy,
-                        buffer + z_stride * z, dx, dy,
-                        dt, csz, NULL,
-                        pix_stride, line_stride, band_stride
-                    );
-                }
+        if (writer.Open(TargetName.c_str(), copt, pool.Size(), bHasNoData, nd)
+            && writer.xsz == osz[0] && writer.ysz == osz[1] && writer.zsz == osz[2] && writer.csz == osz[3]
+            && writer.pszx == pszx && writer.pszy == psz && writer.dt == dt
+            && writer.Interleaved() == cube.interleaved
+            && static_cast<int>(writer.levels.size()) == overviews.Levels())
+        {
+            cube.writer = &writer;
+            cube.pool = &pool;
+            writer.SetDedupe(dedupe);
+            if (verbose)
+                cout << "Writing tiles directly to " << writer.datafname << ", " << pool.Size() << " encoders" << endl;
+        }
+        else {
+            writer.Close();
+            if (verbose)
+                cout << "Writing through GDAL" << endl;
+        }
+    }
+    if (dedupe && !cube.writer)
+        CPLError(CE_Warning, CPLE_NotSupported, "Tiles are not deduplicated when writing through GDAL");
 
-                // Write a cublock
-                for (int endz = 0; endz < dy; endz++) {
-                    GDALDatasetH hDatasetout = outh[endz];
-                    //fprintf(stderr,
-                    //    "Writing Z%d %d,%d - %d,%d %d stride %d %d %d\n",
-                    //    starty + endz, startx, startz, dx, dy,
-                    //    endz * line_stride, pix_stride, z_stride, band_stride
-                    //);
-                    GDALDatasetRasterIO(hDatasetout, GF_Write,
-                        startx, startz, dx, dz,
-                        buffer + endz * line_stride, dx, dz,
-                        dt, csz, NULL,
-                        pix_stride, z_stride, band_stride
-                    );
-                }
-            }
+    // The reductions are 2D MRFs of the input size next to the output, with the input pages
+    // A resumed run keeps the strips already written
+    char **ropt = CSLDuplicate(copt);
+    ropt = CSLSetNameValue(ropt, "ZSIZE", nullptr);
+    ropt = CSLSetNameValue(ropt, "UNIFORM_SCALE", nullptr);
+    ropt = CSLSetNameValue(ropt, "BLOCKXSIZE", CPLOPrintf("%d", pszx));
+    ropt = CSLSetNameValue(ropt, "BLOCKYSIZE", CPLOPrintf("%d", pszy));
+    for (size_t i = 0; i < reductions.size(); i++) {
+        const Reductions::Reduction &r = reductions[i];
+        CPLString RName(CPLFormFilename(CPLGetPath(TargetName.c_str()),
+            CPLOPrintf("%s_%s", CPLGetBasename(TargetName.c_str()), Reductions::Name(r).c_str()), "mrf"));
+        GDALDatasetH h = cube.resume ? GDALOpen(RName, GA_Update)
+            : GDALCreate(d_mrf, RName, xsz, ysz, csz, Reductions::Type(r, dt, zsz), ropt);
+        if (!h) {
+            for (GDALDatasetH rh : cube.reduceh)
+                GDALClose(rh);
+            CSLDestroy(ropt);
+            return Usage(CPLOPrintf("Can't create %s", RName.c_str()), 5);
+        }
+        if (!cube.resume) {
+            for (int c = 0; bHasNoData && r.kind != Reductions::COUNT && c < csz; c++)
+                GDALSetRasterNoDataValue(GDALGetRasterBand(h, c + 1), nd);
+            if (!projection.empty())
+                GDALSetProjection(h, projection);
+            if (hasgt)
+                GDALSetGeoTransform(h, igt);
+        }
+        if (verbose)
+            cout << "Writing the " << Reductions::Name(r) << " to " << RName << endl;
+        cube.reduceh.push_back(h);
+    }
+    CSLDestroy(ropt);
 
-            for (int i = 0; i < outh.size(); i++)
-                GDALClose(outh[i]);
+    stats.Add(PH_OPEN, tcreate.Seconds());
+
+    int ret = (nthreads > 0) ? RunPipeline(cube, nthreads) : RunSequential(cube, prefetch);
+    if (verbose)
+        cout << "Cublock buffers: " << arena.Describe() << endl;
+
+    StageTimer tclose;
+    if (cube.writer && dedupe && verbose)
+        cout << "Duplicate tiles: " << writer.Duplicates() << ", " << writer.SavedBytes() << " bytes not written" << endl;
+    if (cube.writer) {
+        if (!writer.Close() && !ret)
+            ret = 5;
+        // Statistics are kept per slice, outside of the MRF metadata
+        for (int z = cube.slo; !ret && bHasStats && !cube.bandstats && z < cube.shi; z++) {
+            CPLString DName;
+            DName.Printf("%s:MRF:Z%d", TargetName.c_str(), z);
+            GDALDatasetH h = GDALOpen(DName, GA_Update);
+            if (!h) {
+                ret = 5;
+                break;
+            }
+            GDALSetRasterStatistics(GDALGetRasterBand(h, 1), min_v, max_v, mean_v, stdd_v);
+            GDALClose(h);
         }
-        for (int i = 0; i < inh.size(); i++)
-            GDALClose(inh[i]);
+    }
+    for (GDALDatasetH h : cube.reduceh)
+        GDALClose(h);
+    stats.Add(PH_CLOSE, tclose.Seconds());
+    stats.Finish();
+    // Not needed after a successful run
+    journal.Close(ret == 0);
+
+    if (statsname) {
+        // Compressed sizes are the data file sizes
+        MRFInfo iinfo, oinfo;
+        RawFile f;
+        uint64_t isz = 0, osz = 0;
+        if (iinfo.Parse(SourceName.c_str()) && f.Open(iinfo.datafname.c_str()))
+            isz = f.Size();
+        f.Close();
+        if (oinfo.Parse(TargetName.c_str()) && f.Open(oinfo.datafname.c_str()))
+            osz = f.Size();
+        f.Close();
+        stats.SetCompressed(isz, osz);
+
+        stats.Set("input", SourceName);
+        stats.Set("output", TargetName);
+        stats.Set("status", ret);
+        stats.Set("xsize", xsz);
+        stats.Set("ysize", ysz);
+        stats.Set("zsize", zsz);
+        stats.Set("bands", csz);
+        stats.Set("axes", CPLOPrintf("%c%c%c%c", "xyzc"[axes[0]], "xyzc"[axes[1]], "xyzc"[axes[2]], "xyzc"[axes[3]]));
+        stats.Set("first_slice", cube.slo);
+        stats.Set("append_from", appendz >= 0 ? cube.zlo : -1);
+        stats.Set("end_slice", cube.shi);
+        stats.Set("data_type", GDALGetDataTypeName(dt));
+        stats.Set("threads", nthreads);
+        stats.Set("prefetch", nthreads > 0 ? 0 : prefetch);
+        stats.Set("bands_per_pass", cube.cband);
+        stats.Set("z_depth", cube.zdepth);
+        stats.Set("x_width", cube.xblk);
+        stats.Set("buffer_bytes", 2.0 * nslots * cube.BSZ);
+        stats.Set("direct_read", cube.reader ? 1 : 0);
+        stats.Set("direct_write", cube.writer ? 1 : 0);
+        stats.Set("band_stats", cube.bandstats ? 1 : 0);
+        stats.Set("overview_levels", overviews.Levels());
+        stats.Set("overview_tiles", static_cast<double>(overviews.Tiles()));
+        stats.Set("dedupe", cube.writer && dedupe ? 1 : 0);
+        stats.Set("duplicate_tiles", static_cast<double>(writer.Duplicates()));
+        stats.Set("dedupe_saved_bytes", static_cast<double>(writer.SavedBytes()));
+        stats.Set("reductions", reducespec ? reducespec : "");
+        if (!stats.WriteJSON(statsname))
+            CPLError(CE_Warning, CPLE_FileIO, "Can't write %s", statsname);
     }
 
     CSLDestroy(copt);
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
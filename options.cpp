@@ -0,0 +1,59 @@
+#include "options.h"
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+bool ParseAxes(const char *s, int axes[4]) {
+    static const char names[] = "xyzc";
+    bool used[4] = { false, false, false, false };
+    int n = 0;
+    for (; *s && n < 4; s++, n++) {
+        char l = static_cast<char>(tolower(*s));
+        const char *p = strchr(names, l == 'b' ? 'c' : l);
+        if (!p || used[p - names])
+            return false;
+        axes[n] = static_cast<int>(p - names);
+        used[axes[n]] = true;
+    }
+    if (*s || n < 3)
+        return false;
+    for (int a = 0; n == 3 && a < 4; a++)
+        if (!used[a])
+            axes[3] = a;
+    return true;
+}
+
+bool ValidAxes(const int axes[4]) {
+    int seen = 0;
+    for (int i = 0; i < 4; i++)
+        if (axes[i] >= AX_X && axes[i] <= AX_C)
+            seen |= 1 << axes[i];
+    return seen == 0xf;
+}
+
+// Decimal, without anything after it
+static bool ParseWhole(const char *s, long long &v) {
+    char *end = nullptr;
+    errno = 0;
+    v = strtoll(s, &end, 10);
+    return end != s && !*end && !errno;
+}
+
+bool ParseCount(const char *s, int lo, int &v) {
+    long long n;
+    if (!ParseWhole(s, n) || n < lo || n > INT_MAX)
+        return false;
+    v = static_cast<int>(n);
+    return true;
+}
+
+bool ParseMiB(const char *s, size_t &bytes) {
+    long long n;
+    if (!ParseWhole(s, n) || n <= 0 || static_cast<unsigned long long>(n) > (SIZE_MAX >> 20))
+        return false;
+    bytes = static_cast<size_t>(n) << 20;
+    return true;
+}
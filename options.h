@@ -0,0 +1,18 @@
+// Command line values shared by the tools, the input axes and the --axes syntax, counts and sizes
+#pragma once
+#include <cstddef>
+
+enum Axis { AX_X, AX_Y, AX_Z, AX_C };
+
+// Parses the --axes value, the input axes for the output x, y, z and band, as letters
+// A missing fourth one is the input axis not used
+bool ParseAxes(const char *s, int axes[4]);
+
+// Whether axes is a permutation of the four input axes
+bool ValidAxes(const int axes[4]);
+
+// A whole number of at least lo, such as a thread count, nothing else in s
+bool ParseCount(const char *s, int lo, int &v);
+
+// A positive whole number of MiB, as bytes, for -m
+bool ParseMiB(const char *s, size_t &bytes);
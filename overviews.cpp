@@ -0,0 +1,131 @@
+#include "overviews.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+using namespace std;
+
+Overviews::Overviews() : scale(0), pszx(0), pszy(0), nbt(1), pcc(1), dt(GDT_Byte), dtsz(1),
+    average(true), bHasNoData(0), nd(0), ntiles(0)
+{}
+
+void Overviews::Init(int xsz, int ysz, int zsz, int csz, int px, int py, bool interleaved, GDALDataType type,
+    int s, bool avg, int hasnd, double ndv)
+{
+    levels = MRFInfo::Levels(xsz, ysz, zsz, csz, px, py, interleaved ? csz : 1, s);
+    scale = s;
+    pszx = px;
+    pszy = py;
+    nbt = interleaved ? csz : 1;
+    pcc = interleaved ? 1 : csz;
+    dt = type;
+    dtsz = GDALGetDataTypeSizeBytes(dt);
+    // Complex values are not averaged
+    average = avg && !GDALDataTypeIsComplex(dt);
+    bHasNoData = hasnd;
+
+    // NoData, or zero when there is none, same as the MRF driver
+    double f = hasnd ? ndv : 0.0;
+    fill.assign(dtsz, 0);
+    GDALCopyWords64(&f, GDT_Float64, 0, fill.data(), dt, dtsz, 1);
+    GDALCopyWords64(fill.data(), dt, 0, &nd, GDT_Float64, 0, 1);
+    slices.assign(IsActive() ? zsz : 0, map<uint64_t, Tile>());
+}
+
+bool Overviews::Add(int z, int c, int x0, int y0, const char *p, int w, int h, GSpacing pix, GSpacing line,
+    const Sink &sink)
+{
+    return Reduce(1, z, c, x0, y0, p, w, h, pix, line, sink);
+}
+
+// A reduced fill region is the same fill value
+bool Overviews::AddFill(int z, int c, int x0, int y0, int w, int h, const Sink &sink) {
+    return Accumulate(1, z, c, x0 / scale, y0 / scale, fill.data(), (w + scale - 1) / scale,
+        (h + scale - 1) / scale, 0, 0, sink);
+}
+
+bool Overviews::Reduce(int level, int z, int c, int x0, int y0, const char *p, int w, int h,
+    GSpacing pix, GSpacing line, const Sink &sink)
+{
+    int ow = (w + scale - 1) / scale, oh = (h + scale - 1) / scale;
+    vector<char> out(static_cast<size_t>(ow) * oh * dtsz);
+    if (average) {
+        // Rows are converted to double, the result is rounded back to the data type
+        vector<double> row(w), sum(ow), res(ow);
+        vector<int> count(ow);
+        for (int oy = 0; oy < oh; oy++) {
+            fill_n(sum.begin(), ow, 0.0);
+            fill_n(count.begin(), ow, 0);
+            for (int y = oy * scale; y < min(h, oy * scale + scale); y++) {
+                GDALCopyWords64(p + y * line, dt, static_cast<int>(pix), row.data(), GDT_Float64, sizeof(double), w);
+                for (int x = 0; x < w; x++) {
+                    double v = row[x];
+                    if (std::isnan(v) || (bHasNoData && v == nd))
+                        continue;
+                    sum[x / scale] += v;
+                    count[x / scale]++;
+                }
+            }
+            for (int ox = 0; ox < ow; ox++)
+                res[ox] = count[ox] ? sum[ox] / count[ox] : bHasNoData ? nd : numeric_limits<double>::quiet_NaN();
+            GDALCopyWords64(res.data(), GDT_Float64, sizeof(double), out.data() + static_cast<size_t>(oy) * ow * dtsz,
+                dt, dtsz, ow);
+        }
+    }
+    else {
+        // Near the center of each block, same as GDAL
+        char *d = out.data();
+        for (int oy = 0; oy < oh; oy++) {
+            const char *srow = p + min(oy * scale + scale / 2, h - 1) * line;
+            for (int ox = 0; ox < ow; ox++, d += dtsz)
+                memcpy(d, srow + min(ox * scale + scale / 2, w - 1) * pix, dtsz);
+        }
+    }
+    return Accumulate(level, z, c, x0 / scale, y0 / scale, out.data(), ow, oh, dtsz,
+        static_cast<GSpacing>(ow) * dtsz, sink);
+}
+
+bool Overviews::Accumulate(int level, int z, int c, int x0, int y0, const char *p, int w, int h,
+    GSpacing pix, GSpacing line, const Sink &sink)
+{
+    const MRFInfo::Level &l = levels[level - 1];
+    map<uint64_t, Tile> &tiles = slices[z];
+    // Pixel interleaved tiles hold all the bands
+    int tc = nbt > 1 ? 0 : c;
+    int b = nbt > 1 ? c : 0;
+    GSpacing tpix = static_cast<GSpacing>(nbt) * dtsz, tline = tpix * pszx;
+    for (int ty = y0 / pszy; ty * pszy < y0 + h; ty++) {
+        for (int tx = x0 / pszx; tx * pszx < x0 + w; tx++) {
+            int tx0 = tx * pszx, ty0 = ty * pszy;
+            int tw = min(pszx, l.xsz - tx0), th = min(pszy, l.ysz - ty0);
+            int ax = max(x0, tx0), ay = max(y0, ty0);
+            int aw = min(x0 + w, tx0 + tw) - ax, ah = min(y0 + h, ty0 + th) - ay;
+            if (aw <= 0 || ah <= 0)
+                continue;
+
+            uint64_t key = (static_cast<uint64_t>(level) << 56) | ((ty * l.pcx + tx) * pcc + tc);
+            Tile &t = tiles[key];
+            if (t.data.empty()) {
+                t.data.resize(static_cast<size_t>(tline) * pszy);
+                t.filled = 0;
+            }
+            for (int y = ay; y < ay + ah; y++)
+                GDALCopyWords64(p + (y - y0) * line + (ax - x0) * pix, dt, static_cast<int>(pix),
+                    t.data.data() + (y - ty0) * tline + (ax - tx0) * tpix + b * dtsz, dt, static_cast<int>(tpix), aw);
+            t.filled += static_cast<size_t>(aw) * ah;
+            if (t.filled < static_cast<size_t>(tw) * th * nbt)
+                continue;
+
+            // Complete, written, then it goes into the next level
+            ntiles++;
+            if (!sink(level, tx, ty, z, tc, t.data.data(), tw, th, tpix, tline, dtsz))
+                return false;
+            for (int i = 0; level < Levels() && i < nbt; i++)
+                if (!Reduce(level + 1, z, tc + i, tx0, ty0, t.data.data() + i * dtsz, tw, th, tpix, tline, sink))
+                    return false;
+            tiles.erase(key);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,68 @@
+// Reduced resolution levels of every output slice, built from the transposed cublocks
+// Each level is a 1/scale of the previous one, the same as the MRF uniform scale overviews
+// Tiles of a level are kept until all their pixels are in, then written and reduced into the
+// next level, so the full resolution data is only read once
+// Different slices can be added from different threads, the same slice can't
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+#include <gdal.h>
+#include "mrf_info.h"
+
+class Overviews {
+public:
+    // Receives the complete tiles, w by h pixels, with pixel, line and band strides
+    // Pixel interleaved tiles hold all the bands, tc is 0 then
+    typedef std::function<bool(int level, int tx, int ty, int z, int tc,
+        const char *tile, int w, int h, GSpacing pix, GSpacing line, GSpacing band)> Sink;
+
+    Overviews();
+
+    // The levels of an MRF with this size, page size and scale
+    // Average skips NoData and NaN values, otherwise the nearest pixel is used
+    void Init(int xsz, int ysz, int zsz, int csz, int pszx, int pszy, bool interleaved, GDALDataType dt,
+        int scale, bool average, int bHasNoData, double nd);
+    bool IsActive() const { return !levels.empty(); }
+    int Levels() const { return static_cast<int>(levels.size()); }
+
+    // Adds a w by h region of band c of slice z at x0, y0, at full resolution, strides in bytes
+    // The origin is a multiple of the scale, so is the size unless at the edge
+    bool Add(int z, int c, int x0, int y0, const char *p, int w, int h, GSpacing pix, GSpacing line,
+        const Sink &sink);
+    // Same, for a region that only holds the fill value
+    bool AddFill(int z, int c, int x0, int y0, int w, int h, const Sink &sink);
+
+    // Tiles passed to a sink
+    uint64_t Tiles() const { return ntiles; }
+
+private:
+    struct Tile {
+        std::vector<char> data;
+        size_t filled;          // Samples
+    };
+
+    // Reduces a region of level - 1 into a packed one of this level, then adds it
+    bool Reduce(int level, int z, int c, int x0, int y0, const char *p, int w, int h, GSpacing pix, GSpacing line,
+        const Sink &sink);
+    // Adds a region of this level to the tiles it covers, passing on the complete ones
+    bool Accumulate(int level, int z, int c, int x0, int y0, const char *p, int w, int h, GSpacing pix,
+        GSpacing line, const Sink &sink);
+
+    std::vector<MRFInfo::Level> levels;
+    int scale;
+    int pszx, pszy;
+    int nbt;                    // Bands per tile
+    uint64_t pcc;               // Tiles along the bands
+    GDALDataType dt;
+    int dtsz;
+    bool average;
+    int bHasNoData;
+    double nd;                  // As the data type holds it
+    std::vector<char> fill;     // One sample
+    // Partial tiles of each slice, by level, tile row, column and band
+    std::vector<std::map<uint64_t, Tile>> slices;
+    std::atomic<uint64_t> ntiles;
+};
@@ -0,0 +1,145 @@
+// Threading helpers for the mrf_yzzy stages
+#pragma once
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+
+// Bounded, closable queue used to connect the stages
+template<typename T> class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : cap(capacity), closed(false) {}
+
+    // Blocks while full, returns false if the queue has been closed
+    bool push(const T &value) {
+        std::unique_lock<std::mutex> lock(mtx);
+        notfull.wait(lock, [this] { return closed || q.size() < cap; });
+        if (closed)
+            return false;
+        q.push_back(value);
+        notempty.notify_one();
+        return true;
+    }
+
+    // Blocks while empty, returns false once the queue is closed and drained
+    bool pop(T &value) {
+        std::unique_lock<std::mutex> lock(mtx);
+        notempty.wait(lock, [this] { return closed || !q.empty(); });
+        if (q.empty())
+            return false;
+        value = q.front();
+        q.pop_front();
+        notfull.notify_one();
+        return true;
+    }
+
+    // No more pushes, pending items can still be popped
+    void close() {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        notempty.notify_all();
+        notfull.notify_all();
+    }
+
+private:
+    std::deque<T> q;
+    size_t cap;
+    bool closed;
+    std::mutex mtx;
+    std::condition_variable notfull, notempty;
+};
+
+// Runs fn(i) for every i in [0, n), on up to nthreads threads including the caller
+template<typename F> void ParallelFor(int n, int nthreads, F fn) {
+    if (nthreads <= 1 || n <= 1) {
+        for (int i = 0; i < n; i++)
+            fn(i);
+        return;
+    }
+    std::atomic<int> next(0);
+    auto work = [&]() {
+        for (int i = next++; i < n; i = next++)
+            fn(i);
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < std::min(n, nthreads); t++)
+        threads.emplace_back(work);
+    work();
+    for (auto &t : threads)
+        t.join();
+}
+
+// Persistent worker threads, for work that needs per thread state
+// Run calls fn(i, worker) for every i in [0, n) and returns when all are done,
+// worker is in [0, Size()), the caller is worker 0
+class ThreadPool {
+public:
+    explicit ThreadPool(int nthreads) : gen(0), n(0), next(0), busy(0), quit(false) {
+        for (int w = 1; w < nthreads; w++)
+            threads.emplace_back([this, w] { Work(w); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            quit = true;
+        }
+        start.notify_all();
+        for (auto &t : threads)
+            t.join();
+    }
+
+    int Size() const { return static_cast<int>(threads.size()) + 1; }
+
+    void Run(size_t count, const std::function<void(size_t, int)> &fn) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            job = fn;
+            n = count;
+            next = 0;
+            busy = static_cast<int>(threads.size());
+            gen++;
+        }
+        start.notify_all();
+        Drain(0);
+        std::unique_lock<std::mutex> lock(mtx);
+        done.wait(lock, [this] { return busy == 0; });
+        job = nullptr;
+    }
+
+private:
+    void Drain(int w) {
+        for (size_t i = next++; i < n; i = next++)
+            job(i, w);
+    }
+
+    void Work(int w) {
+        size_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                start.wait(lock, [&] { return quit || gen != seen; });
+                if (quit)
+                    return;
+                seen = gen;
+            }
+            Drain(w);
+            std::lock_guard<std::mutex> lock(mtx);
+            if (--busy == 0)
+                done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::function<void(size_t, int)> job;
+    size_t gen, n;
+    std::atomic<size_t> next;
+    int busy;
+    bool quit;
+    std::mutex mtx;
+    std::condition_variable start, done;
+};
@@ -0,0 +1,295 @@
+#include "reduce.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <cpl_string.h>
+
+using namespace std;
+
+bool Reductions::Parse(const char *s, vector<Reduction> &r) {
+    CPLStringList names(CSLTokenizeString2(s, ",", 0));
+    r.clear();
+    for (int i = 0; i < names.Count(); i++) {
+        const char *n = names[i];
+        Reduction red = { MEAN, 0 };
+        if (EQUAL(n, "mean") || EQUAL(n, "avg"))
+            red.kind = MEAN;
+        else if (EQUAL(n, "min"))
+            red.kind = MIN;
+        else if (EQUAL(n, "max"))
+            red.kind = MAX;
+        else if (EQUAL(n, "count"))
+            red.kind = COUNT;
+        else if ((n[0] == 'p' || n[0] == 'P') && n[1]) {
+            char *end = nullptr;
+            double p = strtod(n + 1, &end);
+            if (*end || p < 0 || p > 100)
+                return false;
+            red.kind = PERCENTILE;
+            red.q = p / 100;
+        }
+        else
+            return false;
+        r.push_back(red);
+    }
+    return !r.empty();
+}
+
+string Reductions::Name(const Reduction &r) {
+    switch (r.kind) {
+    case MEAN: return "mean";
+    case MIN: return "min";
+    case MAX: return "max";
+    case COUNT: return "count";
+    default: return CPLOPrintf("p%g", r.q * 100);
+    }
+}
+
+// The mean and the percentiles are fractional, single precision is enough for the small types
+GDALDataType Reductions::Type(const Reduction &r, GDALDataType dt, int zsz) {
+    switch (r.kind) {
+    case MIN:
+    case MAX:
+        return dt;
+    case COUNT:
+        return zsz <= 65535 ? GDT_UInt16 : GDT_UInt32;
+    default:
+        return GDALGetDataTypeSizeBytes(dt) < 4 || dt == GDT_Float32 ? GDT_Float32 : GDT_Float64;
+    }
+}
+
+// Jain and Chlamtac, the five markers track the minimum, p/2, p, (1+p)/2 and the maximum
+// The first five values are kept sorted
+void Reductions::P2::Add(double x, double p, uint32_t count) {
+    if (count < 5) {
+        int i = static_cast<int>(count);
+        for (; i > 0 && q[i - 1] > x; i--)
+            q[i] = q[i - 1];
+        q[i] = x;
+        if (count == 4)
+            for (int j = 0; j < 5; j++)
+                n[j] = j + 1;
+        return;
+    }
+
+    int k = 0;
+    if (x < q[0])
+        q[0] = x;
+    else if (x >= q[4]) {
+        q[4] = x;
+        k = 3;
+    }
+    else
+        while (x >= q[k + 1])
+            k++;
+    for (int i = k + 1; i < 5; i++)
+        n[i]++;
+
+    // Markers more than one position off move by one, with a parabolic height when it stays in order
+    const double dn[5] = { 0, p / 2, p, (1 + p) / 2, 1 };
+    for (int i = 1; i < 4; i++) {
+        double d = 1 + static_cast<double>(count) * dn[i] - n[i];
+        if ((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)) {
+            int s = d > 0 ? 1 : -1;
+            double h = q[i] + static_cast<double>(s) / (n[i + 1] - n[i - 1])
+                * ((n[i] - n[i - 1] + s) * (q[i + 1] - q[i]) / (n[i + 1] - n[i])
+                    + (n[i + 1] - n[i] - s) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+            if (!(q[i - 1] < h && h < q[i + 1]))
+                h = q[i] + s * (q[i + s] - q[i]) / (n[i + s] - n[i]);
+            q[i] = h;
+            n[i] += s;
+        }
+    }
+}
+
+// Interpolated between the closest ranks while the values are all known
+double Reductions::P2::Value(double p, uint32_t count) const {
+    if (count > 5)
+        return p == 0 ? q[0] : p == 1 ? q[4] : q[2];
+    double pos = p * (count - 1);
+    int lo = static_cast<int>(pos);
+    int hi = min(lo + 1, static_cast<int>(count) - 1);
+    return q[lo] + (pos - lo) * (q[hi] - q[lo]);
+}
+
+template<typename T> static inline T Load(const char *p) {
+    T v;
+    memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+// Always false for integers, the compiler drops the test
+template<typename T> static inline bool IsNaN(T v) {
+    return v != v;
+}
+
+// One row at a time, the percentiles first since they need the count before the row
+// The sum, range and count loop is branch free, it vectorizes when the pixels are contiguous
+template<typename T> static void Accumulate(const char *p, int w, int h, int nz, GSpacing pix, GSpacing line,
+    GSpacing zstride, int bHasNoData, double nd, double *sum, double *mn, double *mx, uint32_t *count,
+    Reductions::P2 *p2, size_t plane, const vector<double> &qs, int sw)
+{
+    // A NoData value that doesn't fit the type never matches
+    bool skip = bHasNoData && !std::isnan(nd)
+        && nd >= static_cast<double>(numeric_limits<T>::lowest()) && nd <= static_cast<double>(numeric_limits<T>::max())
+        && static_cast<double>(static_cast<T>(nd)) == nd;
+    T ndv = skip ? static_cast<T>(nd) : T(0);
+
+    for (int y = 0; y < h; y++) {
+        double *s = sum + static_cast<size_t>(y) * sw, *lo = mn + static_cast<size_t>(y) * sw;
+        double *hi = mx + static_cast<size_t>(y) * sw;
+        uint32_t *n = count + static_cast<size_t>(y) * sw;
+        for (int z = 0; z < nz; z++) {
+            const char *row = p + z * zstride + y * line;
+            if (p2) {
+                for (int x = 0; x < w; x++) {
+                    T v = Load<T>(row + x * pix);
+                    if (IsNaN(v) || (skip && v == ndv))
+                        continue;
+                    for (size_t i = 0; i < qs.size(); i++)
+                        p2[i * plane + static_cast<size_t>(y) * sw + x].Add(static_cast<double>(v), qs[i], n[x]);
+                }
+            }
+            for (int x = 0; x < w; x++) {
+                T v = Load<T>(row + x * pix);
+                bool ok = !IsNaN(v) && !(skip && v == ndv);
+                double d = static_cast<double>(v);
+                s[x] += ok ? d : 0.0;
+                lo[x] = ok && d < lo[x] ? d : lo[x];
+                hi[x] = ok && d > hi[x] ? d : hi[x];
+                n[x] += ok ? 1 : 0;
+            }
+        }
+    }
+}
+
+Reductions::Reductions() : axis(1), blk(1), xsz(0), ysz(0), csz(0), dt(GDT_Unknown), bHasNoData(0), nd(0) {}
+
+void Reductions::Init(const vector<Reduction> &r, int ax, int b, int x, int y, int c, GDALDataType type,
+    int hasnd, double ndv)
+{
+    reductions = r;
+    quantiles.clear();
+    for (const Reduction &red : r)
+        if (red.kind == PERCENTILE)
+            quantiles.push_back(red.q);
+    axis = ax;
+    blk = b;
+    xsz = x;
+    ysz = y;
+    csz = c;
+    dt = type;
+    bHasNoData = hasnd;
+    nd = ndv;
+}
+
+Reductions::Strip &Reductions::Get(int x0, int y0) {
+    int s = axis == 0 ? x0 - x0 % blk : y0 - y0 % blk;
+    lock_guard<mutex> lock(mtx);
+    unique_ptr<Strip> &st = strips[s];
+    if (!st) {
+        st.reset(new Strip);
+        st->x0 = axis == 0 ? s : 0;
+        st->y0 = axis == 0 ? 0 : s;
+        st->w = axis == 0 ? min(blk, xsz - s) : xsz;
+        st->h = axis == 0 ? ysz : min(blk, ysz - s);
+        size_t npix = static_cast<size_t>(st->w) * st->h * csz;
+        st->sum.assign(npix, 0);
+        st->mn.assign(npix, numeric_limits<double>::infinity());
+        st->mx.assign(npix, -numeric_limits<double>::infinity());
+        st->count.assign(npix, 0);
+        st->p2.resize(npix * quantiles.size());
+    }
+    return *st;
+}
+
+void Reductions::Add(int x0, int y0, int c, const char *p, int w, int h, int nz, GSpacing pix, GSpacing line,
+    GSpacing zstride)
+{
+    Strip &st = Get(x0, y0);
+    size_t plane = static_cast<size_t>(st.w) * st.h * csz;
+    size_t off = (static_cast<size_t>(c) * st.h + (y0 - st.y0)) * st.w + (x0 - st.x0);
+    Reductions::P2 *p2 = quantiles.empty() ? nullptr : &st.p2[off];
+#define ACCUMULATE(T) Accumulate<T>(p, w, h, nz, pix, line, zstride, bHasNoData, nd, &st.sum[off], &st.mn[off], \
+    &st.mx[off], &st.count[off], p2, plane, quantiles, st.w)
+    switch (dt) {
+    case GDT_Byte: ACCUMULATE(uint8_t); break;
+    case GDT_UInt16: ACCUMULATE(uint16_t); break;
+    case GDT_Int16: ACCUMULATE(int16_t); break;
+    case GDT_UInt32: ACCUMULATE(uint32_t); break;
+    case GDT_Int32: ACCUMULATE(int32_t); break;
+    case GDT_Float32: ACCUMULATE(float); break;
+    case GDT_Float64: ACCUMULATE(double); break;
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 5, 0)
+    case GDT_UInt64: ACCUMULATE(uint64_t); break;
+    case GDT_Int64: ACCUMULATE(int64_t); break;
+#endif
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 7, 0)
+    case GDT_Int8: ACCUMULATE(int8_t); break;
+#endif
+    default: break;
+    }
+#undef ACCUMULATE
+}
+
+void Reductions::AddConstant(int x0, int y0, int c, int w, int h, int nz, double v) {
+    Strip &st = Get(x0, y0);
+    if (std::isnan(v) || (bHasNoData && v == nd))
+        return;
+    size_t plane = static_cast<size_t>(st.w) * st.h * csz;
+    for (int y = 0; y < h; y++) {
+        size_t off = (static_cast<size_t>(c) * st.h + (y0 - st.y0 + y)) * st.w + (x0 - st.x0);
+        for (int x = 0; x < w; x++) {
+            size_t i = off + x;
+            for (size_t k = 0; k < quantiles.size(); k++)
+                for (int z = 0; z < nz; z++)
+                    st.p2[k * plane + i].Add(v, quantiles[k], st.count[i] + z);
+            st.sum[i] += v * nz;
+            st.mn[i] = min(st.mn[i], v);
+            st.mx[i] = max(st.mx[i], v);
+            st.count[i] += nz;
+        }
+    }
+}
+
+bool Reductions::Finish(int s, const vector<GDALDatasetH> &outh) {
+    unique_ptr<Strip> st;
+    {
+        lock_guard<mutex> lock(mtx);
+        auto it = strips.find(s);
+        if (it == strips.end())
+            return true;
+        st = move(it->second);
+        strips.erase(it);
+    }
+
+    // Pixels without values are NoData, or NaN without one, counts are zero
+    double empty = bHasNoData ? nd : numeric_limits<double>::quiet_NaN();
+    size_t npix = st->count.size();
+    vector<double> v(npix);
+    size_t pct = 0;
+    for (size_t r = 0; r < reductions.size(); r++) {
+        const Reduction &red = reductions[r];
+        for (size_t i = 0; i < npix; i++) {
+            uint32_t n = st->count[i];
+            switch (red.kind) {
+            case MEAN: v[i] = n ? st->sum[i] / n : empty; break;
+            case MIN: v[i] = n ? st->mn[i] : empty; break;
+            case MAX: v[i] = n ? st->mx[i] : empty; break;
+            case COUNT: v[i] = n; break;
+            default: v[i] = n ? st->p2[pct * npix + i].Value(red.q, n) : empty; break;
+            }
+        }
+        if (red.kind == PERCENTILE)
+            pct++;
+        if (CE_None != GDALDatasetRasterIOEx(outh[r], GF_Write, st->x0, st->y0, st->w, st->h, v.data(), st->w, st->h,
+            GDT_Float64, csz, nullptr, sizeof(double), sizeof(double) * st->w,
+            sizeof(double) * st->w * st->h, nullptr))
+            return false;
+        // On disk before the journal moves past the strip
+        GDALFlushCache(outh[r]);
+    }
+    return true;
+}
@@ -0,0 +1,75 @@
+// Reductions of the input along Z, the mean, minimum, maximum, valid count and percentiles of every
+// pixel and band, written as 2D rasters of the input size
+// Accumulated from the input cublocks, in strips along the output slice axis, which has to be the
+// input x or y. A strip is complete once the cublocks of its slice group are done
+// Percentiles are estimated with the P-square algorithm, exact up to 5 values
+// Different bands of a strip can be added from different threads, the same band can't
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <gdal.h>
+
+class Reductions {
+public:
+    enum Kind { MEAN, MIN, MAX, COUNT, PERCENTILE };
+    struct Reduction {
+        Kind kind;
+        double q;               // Percentile, as a fraction
+    };
+
+    // A comma separated list, mean, min, max, count and pNN, such as p50 or p2.5
+    static bool Parse(const char *s, std::vector<Reduction> &r);
+    // Used in the output file names
+    static std::string Name(const Reduction &r);
+    // Output data type, the input one for the minimum and maximum
+    static GDALDataType Type(const Reduction &r, GDALDataType dt, int zsz);
+
+    Reductions();
+
+    // axis is the input x or y, 0 or 1, strips are blk wide along it
+    void Init(const std::vector<Reduction> &r, int axis, int blk, int xsz, int ysz, int csz, GDALDataType dt,
+        int bHasNoData, double nd);
+    bool IsActive() const { return !reductions.empty(); }
+
+    // Adds a w by h region of band c at x0, y0, nz values deep, strides in bytes
+    void Add(int x0, int y0, int c, const char *p, int w, int h, int nz, GSpacing pix, GSpacing line,
+        GSpacing zstride);
+    // Same, all the values are v
+    void AddConstant(int x0, int y0, int c, int w, int h, int nz, double v);
+
+    // Writes the complete strip starting at s to the outputs, one per reduction, and drops it
+    bool Finish(int s, const std::vector<GDALDatasetH> &outh);
+
+    // Estimator of one percentile, the marker heights and positions
+    struct P2 {
+        double q[5];
+        int n[5];
+        void Add(double x, double p, uint32_t count);
+        double Value(double p, uint32_t count) const;
+    };
+
+private:
+    struct Strip {
+        int x0, y0, w, h;
+        std::vector<double> sum, mn, mx;
+        std::vector<uint32_t> count;
+        std::vector<P2> p2;     // Per percentile, then pixel
+    };
+
+    // The strip holding a region, created on first use
+    Strip &Get(int x0, int y0);
+
+    std::vector<Reduction> reductions;
+    std::vector<double> quantiles;
+    int axis, blk;
+    int xsz, ysz, csz;
+    GDALDataType dt;
+    int bHasNoData;
+    double nd;
+    std::mutex mtx;
+    std::map<int, std::unique_ptr<Strip>> strips;
+};
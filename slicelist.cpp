@@ -0,0 +1,58 @@
+#include "slicelist.h"
+#include <algorithm>
+#include <cstring>
+#include <cpl_conv.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+
+using namespace std;
+
+// Shell style, * is any sequence and ? any character
+static bool Match(const char *pat, const char *s) {
+    for (; *pat; pat++, s++) {
+        if (*pat == '*') {
+            for (; *s; s++)
+                if (Match(pat + 1, s))
+                    return true;
+            return Match(pat + 1, s);
+        }
+        if (!*s || (*pat != '?' && *pat != *s))
+            return false;
+    }
+    return !*s;
+}
+
+bool IsSliceList(const char *name) {
+    return name[0] == '@' || strpbrk(CPLGetFilename(name), "*?");
+}
+
+bool ReadSliceList(const char *name, vector<string> &files) {
+    files.clear();
+    if (name[0] == '@') {
+        VSILFILE *f = VSIFOpenL(name + 1, "rb");
+        if (!f)
+            return false;
+        // Relative names are relative to the list
+        CPLString dir(CPLGetPath(name + 1));
+        while (const char *line = CPLReadLineL(f)) {
+            CPLString fname(line);
+            fname.Trim();
+            if (fname.empty() || fname[0] == '#')
+                continue;
+            if (CPLIsFilenameRelative(fname) && !dir.empty())
+                fname = CPLFormFilename(dir, fname, nullptr);
+            files.push_back(fname);
+        }
+        VSIFCloseL(f);
+        return !files.empty();
+    }
+
+    CPLString dir(CPLGetPath(name));
+    const char *pattern = CPLGetFilename(name);
+    CPLStringList entries(VSIReadDir(dir.empty() ? "." : dir.c_str()));
+    for (int i = 0; i < entries.Count(); i++)
+        if (Match(pattern, entries[i]))
+            files.push_back(dir.empty() ? string(entries[i]) : string(CPLFormFilename(dir, entries[i], nullptr)));
+    sort(files.begin(), files.end());
+    return !files.empty();
+}
@@ -0,0 +1,11 @@
+// Input Z slices from separate 2D rasters, in any format GDAL reads
+// @list.txt holds one name per line, in Z order. A name with * or ? in the file part is a pattern,
+// the matching files are used in name order
+#pragma once
+#include <string>
+#include <vector>
+
+bool IsSliceList(const char *name);
+
+// The slice file names, false if there are none
+bool ReadSliceList(const char *name, std::vector<std::string> &files);
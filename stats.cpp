@@ -0,0 +1,179 @@
+#include "stats.h"
+#include <cstdio>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#include <io.h>
+#pragma comment(lib, "psapi.lib")
+#define ISATTY(f) _isatty(_fileno(f))
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#define ISATTY(f) isatty(fileno(f))
+#endif
+
+using namespace std;
+
+static const char *PhaseName[PH_COUNT] = { "open", "read", "transpose", "write", "close" };
+
+// Peak resident size of this process, in bytes
+static uint64_t PeakRSS() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru))
+        return 0;
+#if defined(__APPLE__)
+    return ru.ru_maxrss;
+#else
+    return static_cast<uint64_t>(ru.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+static string Quote(const string &s) {
+    string r("\"");
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            r += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            r += buf;
+        }
+        else
+            r += c;
+    }
+    return r + "\"";
+}
+
+static string Duration(double s) {
+    char buf[32];
+    long t = static_cast<long>(s + 0.5);
+    snprintf(buf, sizeof(buf), "%ld:%02ld:%02ld", t / 3600, (t / 60) % 60, t % 60);
+    return buf;
+}
+
+Stats::Stats() : wall(0), last(0), interval(1), tty(false), nblocks(0), first(0), done(0),
+    bytes(0), tiles_in(0), tiles_out(0), skipped(0), compressed_in(0), compressed_out(0)
+{
+    for (auto &v : ns)
+        v = 0;
+}
+
+void Stats::Start(size_t n, size_t f) {
+    nblocks = n;
+    first = done = f;
+    blocks.assign(n, Block());
+    // Logs get fewer lines
+    tty = ISATTY(stderr) != 0;
+    interval = tty ? 1 : 30;
+    timer = StageTimer();
+    last = 0;
+}
+
+void Stats::Locate(size_t seq, int x, int y, int z, int c) {
+    if (seq >= blocks.size())
+        return;
+    Block &b = blocks[seq];
+    b.x = x;
+    b.y = y;
+    b.z = z;
+    b.c = c;
+}
+
+void Stats::Add(Phase ph, double seconds, size_t seq) {
+    ns[ph] += static_cast<uint64_t>(seconds * 1e9);
+    // Each phase of a cublock is timed by a single thread
+    if (seq < blocks.size())
+        blocks[seq].t[ph] += static_cast<float>(seconds);
+}
+
+void Stats::Count(uint64_t b, uint64_t tin, uint64_t tout) {
+    bytes += b;
+    tiles_in += tin;
+    tiles_out += tout;
+}
+
+void Stats::Done(size_t seq) {
+    done = seq + 1;
+    double now = timer.Seconds();
+    if (now - last >= interval) {
+        last = now;
+        Progress(false);
+    }
+}
+
+void Stats::Finish() {
+    wall = timer.Seconds();
+    Progress(true);
+}
+
+void Stats::Progress(bool final) {
+    double now = timer.Seconds();
+    double mbs = now > 0 ? bytes / now / 1e6 : 0;
+    string eta = (done > first && !final) ? Duration(now * (nblocks - done) / (done - first)) : string("-");
+    fprintf(stderr, "%s%llu of %llu cublocks, %.1f%%, %.1f MB/s, elapsed %s, ETA %s%s",
+        tty ? "\r" : "", static_cast<unsigned long long>(done), static_cast<unsigned long long>(nblocks),
+        nblocks ? 100.0 * done / nblocks : 100.0, mbs, Duration(now).c_str(), eta.c_str(),
+        (tty && !final) ? "   " : "\n");
+    fflush(stderr);
+}
+
+void Stats::Set(const char *key, const string &value) {
+    info.emplace_back(key, Quote(value));
+}
+
+void Stats::Set(const char *key, double value) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.17g", value);
+    info.emplace_back(key, buf);
+}
+
+bool Stats::WriteJSON(const char *fname) const {
+    FILE *f = fopen(fname, "w");
+    if (!f)
+        return false;
+
+    fprintf(f, "{\n");
+    for (auto &kv : info)
+        fprintf(f, "  %s: %s,\n", Quote(kv.first).c_str(), kv.second.c_str());
+    fprintf(f, "  \"wall_seconds\": %.6f,\n", wall);
+
+    // Thread seconds, phases overlap when pipelined
+    fprintf(f, "  \"phase_seconds\": {");
+    for (int ph = 0; ph < PH_COUNT; ph++)
+        fprintf(f, "%s\"%s\": %.6f", ph ? ", " : "", PhaseName[ph], ns[ph] / 1e9);
+    fprintf(f, "},\n");
+
+    // The cublocks hold the same uncompressed data in and out
+    fprintf(f, "  \"bytes\": %llu,\n", static_cast<unsigned long long>(bytes));
+    fprintf(f, "  \"compressed_in\": %llu,\n  \"compressed_out\": %llu,\n",
+        static_cast<unsigned long long>(compressed_in), static_cast<unsigned long long>(compressed_out));
+    fprintf(f, "  \"compression_ratio_in\": %.4f,\n  \"compression_ratio_out\": %.4f,\n",
+        compressed_in ? double(bytes) / compressed_in : 0.0,
+        compressed_out ? double(bytes) / compressed_out : 0.0);
+    fprintf(f, "  \"tiles_read\": %llu,\n  \"tiles_written\": %llu,\n",
+        static_cast<unsigned long long>(tiles_in), static_cast<unsigned long long>(tiles_out));
+    fprintf(f, "  \"empty_cublocks\": %llu,\n", static_cast<unsigned long long>(skipped));
+    fprintf(f, "  \"MB_per_second\": %.3f,\n", wall > 0 ? bytes / wall / 1e6 : 0.0);
+    fprintf(f, "  \"peak_rss_bytes\": %llu,\n", static_cast<unsigned long long>(PeakRSS()));
+
+    fprintf(f, "  \"cublocks\": [");
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const Block &b = blocks[i];
+        fprintf(f, "%s\n    {\"x\": %d, \"y\": %d, \"z\": %d, \"c\": %d", i ? "," : "", b.x, b.y, b.z, b.c);
+        for (int ph = 0; ph < PH_COUNT; ph++)
+            if (ph != PH_CLOSE)
+                fprintf(f, ", \"%s\": %.6f", PhaseName[ph], b.t[ph]);
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n  ]\n}\n");
+
+    return 0 == fclose(f);
+}
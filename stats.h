@@ -0,0 +1,79 @@
+// Run statistics, time per phase and per cublock, data counters and the progress line
+// Stages on different threads add to the same Stats, the counters are atomic
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+
+enum Phase { PH_OPEN, PH_READ, PH_TRANSPOSE, PH_WRITE, PH_CLOSE, PH_COUNT };
+
+// Wall time since construction
+class StageTimer {
+public:
+    StageTimer() : t0(std::chrono::steady_clock::now()) {}
+    double Seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point t0;
+};
+
+class Stats {
+public:
+    Stats();
+
+    // Starts the clock, for nblocks cublocks, the ones before first are already done
+    void Start(size_t nblocks, size_t first = 0);
+
+    // Cublock origin, reported with its times
+    void Locate(size_t seq, int x, int y, int z, int c);
+
+    // Thread time spent in a phase, also attributed to cublock seq if valid
+    void Add(Phase ph, double seconds, size_t seq = SIZE_MAX);
+
+    // Uncompressed bytes, input and output tiles moved by a cublock
+    void Count(uint64_t bytes, uint64_t tiles_in, uint64_t tiles_out);
+    // A cublock with only empty input tiles, not read or written
+    void Skip() { skipped++; }
+
+    // Compressed sizes of the input and output data, from the files
+    void SetCompressed(uint64_t in, uint64_t out) { compressed_in = in; compressed_out = out; }
+
+    // Called in order as cublocks are written, shows a progress line now and then
+    void Done(size_t seq);
+    // Ends the progress line
+    void Finish();
+
+    // Run description for the report
+    void Set(const char *key, const std::string &value);
+    void Set(const char *key, double value);
+
+    bool WriteJSON(const char *fname) const;
+
+private:
+    struct Block {
+        int x, y, z, c;
+        float t[PH_COUNT];
+    };
+
+    void Progress(bool final);
+
+    StageTimer timer;
+    double wall;
+    double last;
+    double interval;
+    bool tty;
+    size_t nblocks;
+    size_t first;
+    size_t done;
+    std::atomic<uint64_t> ns[PH_COUNT];
+    std::atomic<uint64_t> bytes, tiles_in, tiles_out, skipped;
+    uint64_t compressed_in, compressed_out;
+    std::vector<Block> blocks;
+    // Key and JSON formatted value
+    std::vector<std::pair<std::string, std::string>> info;
+};
@@ -0,0 +1,243 @@
+#include "transpose.h"
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+// The same templates are compiled for several x86 instruction sets, picked at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define YZZY_X86_DISPATCH
+#define KERNEL_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define KERNEL_INLINE __forceinline
+#else
+#define KERNEL_INLINE inline
+#endif
+
+using namespace std;
+
+// Sixteen byte elements, complex double
+struct Elem16 {
+    uint64_t lo, hi;
+};
+
+// Band count known at compile time, the compiler generates the shuffles
+template<typename T, int C>
+static KERNEL_INLINE void InterleaveC(const char *const *src, size_t n, char *dst, int stride) {
+    const T *s[C];
+    for (int b = 0; b < C; b++)
+        s[b] = reinterpret_cast<const T *>(src[b]);
+    T *d = reinterpret_cast<T *>(dst);
+    if (stride == C) {
+        for (size_t x = 0; x < n; x++)
+            for (int b = 0; b < C; b++)
+                d[x * C + b] = s[b][x];
+    }
+    else {
+        for (size_t x = 0; x < n; x++)
+            for (int b = 0; b < C; b++)
+                d[x * stride + b] = s[b][x];
+    }
+}
+
+// Any band count, blocked so the output span stays in cache while the bands are scattered
+template<typename T>
+static KERNEL_INLINE void InterleaveN(const char *const *src, int c, size_t n, char *dst, int stride) {
+    const size_t BLK = 64;
+    T *d = reinterpret_cast<T *>(dst);
+    for (size_t x0 = 0; x0 < n; x0 += BLK) {
+        size_t x1 = min(n, x0 + BLK);
+        for (int b = 0; b < c; b++) {
+            const T *s = reinterpret_cast<const T *>(src[b]);
+            for (size_t x = x0; x < x1; x++)
+                d[x * stride + b] = s[x];
+        }
+    }
+}
+
+template<typename T>
+static KERNEL_INLINE void InterleaveT(const char *const *src, int c, size_t n, char *dst, int stride) {
+    switch (c) {
+    case 1:
+        if (stride == 1)
+            memcpy(dst, src[0], n * sizeof(T));
+        else
+            InterleaveC<T, 1>(src, n, dst, stride);
+        break;
+    case 2:
+        InterleaveC<T, 2>(src, n, dst, stride);
+        break;
+    case 3:
+        InterleaveC<T, 3>(src, n, dst, stride);
+        break;
+    case 4:
+        InterleaveC<T, 4>(src, n, dst, stride);
+        break;
+    default:
+        InterleaveN<T>(src, c, n, dst, stride);
+    }
+}
+
+static KERNEL_INLINE void InterleaveAny(int dtsz, int c, const char *const *src, size_t n, char *dst, int stride) {
+    switch (dtsz) {
+    case 1:
+        InterleaveT<uint8_t>(src, c, n, dst, stride);
+        break;
+    case 2:
+        InterleaveT<uint16_t>(src, c, n, dst, stride);
+        break;
+    case 4:
+        InterleaveT<uint32_t>(src, c, n, dst, stride);
+        break;
+    case 8:
+        InterleaveT<uint64_t>(src, c, n, dst, stride);
+        break;
+    case 16:
+        InterleaveT<Elem16>(src, c, n, dst, stride);
+        break;
+    default: // Not a GDAL type, one element at a time
+        for (size_t x = 0; x < n; x++)
+            for (int b = 0; b < c; b++)
+                memcpy(dst + (x * stride + b) * dtsz, src[b] + x * dtsz, dtsz);
+    }
+}
+
+// Transposes axis 0 with axis j of a 3D block, in square tiles so both sides stay in cache
+// The destination is written along axis 0, the remaining axis is the outer loop
+template<typename T>
+static KERNEL_INLINE void PermuteT(const size_t *dims, const char *src, const ptrdiff_t *ss,
+    char *dst, const ptrdiff_t *ds, int j)
+{
+    const size_t BLK = 32;
+    int k = 3 - j;
+    for (size_t o = 0; o < dims[k]; o++) {
+        const char *s = src + o * ss[k];
+        char *d = dst + o * ds[k];
+        for (size_t j0 = 0; j0 < dims[j]; j0 += BLK) {
+            size_t j1 = min(dims[j], j0 + BLK);
+            for (size_t i0 = 0; i0 < dims[0]; i0 += BLK) {
+                size_t i1 = min(dims[0], i0 + BLK);
+                for (size_t jj = j0; jj < j1; jj++) {
+                    const char *sr = s + jj * ss[j];
+                    T *dr = reinterpret_cast<T *>(d + jj * ds[j]);
+                    for (size_t i = i0; i < i1; i++)
+                        *reinterpret_cast<T *>(reinterpret_cast<char *>(dr) + i * ds[0]) =
+                            *reinterpret_cast<const T *>(sr + i * ss[0]);
+                }
+            }
+        }
+    }
+}
+
+static KERNEL_INLINE void PermuteAny(int dtsz, const size_t *dims, const char *src, const ptrdiff_t *ss,
+    char *dst, const ptrdiff_t *ds)
+{
+    // Same axis contiguous on both sides, row copies
+    if (ss[0] == dtsz && ds[0] == dtsz) {
+        for (size_t z = 0; z < dims[2]; z++)
+            for (size_t y = 0; y < dims[1]; y++)
+                memcpy(dst + z * ds[2] + y * ds[1], src + z * ss[2] + y * ss[1], dims[0] * dtsz);
+        return;
+    }
+
+    // The other tile axis is the one closest to contiguous in the source
+    int j = (abs(ss[1]) <= abs(ss[2])) ? 1 : 2;
+    switch (dtsz) {
+    case 1:
+        PermuteT<uint8_t>(dims, src, ss, dst, ds, j);
+        break;
+    case 2:
+        PermuteT<uint16_t>(dims, src, ss, dst, ds, j);
+        break;
+    case 4:
+        PermuteT<uint32_t>(dims, src, ss, dst, ds, j);
+        break;
+    case 8:
+        PermuteT<uint64_t>(dims, src, ss, dst, ds, j);
+        break;
+    case 16:
+        PermuteT<Elem16>(dims, src, ss, dst, ds, j);
+        break;
+    default:
+        for (size_t z = 0; z < dims[2]; z++)
+            for (size_t y = 0; y < dims[1]; y++)
+                for (size_t x = 0; x < dims[0]; x++)
+                    memcpy(dst + z * ds[2] + y * ds[1] + x * ds[0], src + z * ss[2] + y * ss[1] + x * ss[0], dtsz);
+    }
+}
+
+typedef void (*InterleaveFn)(int, int, const char *const *, size_t, char *, int);
+typedef void (*PermuteFn)(int, const size_t *, const char *, const ptrdiff_t *, char *, const ptrdiff_t *);
+
+// Baseline, SSE2 on x86-64
+static void InterleaveDefault(int dtsz, int c, const char *const *src, size_t n, char *dst, int stride) {
+    InterleaveAny(dtsz, c, src, n, dst, stride);
+}
+
+static void PermuteDefault(int dtsz, const size_t *dims, const char *src, const ptrdiff_t *ss,
+    char *dst, const ptrdiff_t *ds)
+{
+    PermuteAny(dtsz, dims, src, ss, dst, ds);
+}
+
+#if defined(YZZY_X86_DISPATCH)
+__attribute__((target("avx2")))
+static void InterleaveAVX2(int dtsz, int c, const char *const *src, size_t n, char *dst, int stride) {
+    InterleaveAny(dtsz, c, src, n, dst, stride);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void InterleaveAVX512(int dtsz, int c, const char *const *src, size_t n, char *dst, int stride) {
+    InterleaveAny(dtsz, c, src, n, dst, stride);
+}
+
+__attribute__((target("avx2")))
+static void PermuteAVX2(int dtsz, const size_t *dims, const char *src, const ptrdiff_t *ss,
+    char *dst, const ptrdiff_t *ds)
+{
+    PermuteAny(dtsz, dims, src, ss, dst, ds);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void PermuteAVX512(int dtsz, const size_t *dims, const char *src, const ptrdiff_t *ss,
+    char *dst, const ptrdiff_t *ds)
+{
+    PermuteAny(dtsz, dims, src, ss, dst, ds);
+}
+#endif
+
+struct Kernel {
+    InterleaveFn fn;
+    PermuteFn permute;
+    const char *name;
+};
+
+static const Kernel &Pick() {
+    static const Kernel k = []() {
+#if defined(YZZY_X86_DISPATCH)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw"))
+            return Kernel{ InterleaveAVX512, PermuteAVX512, "AVX-512" };
+        if (__builtin_cpu_supports("avx2"))
+            return Kernel{ InterleaveAVX2, PermuteAVX2, "AVX2" };
+        return Kernel{ InterleaveDefault, PermuteDefault, "SSE2" };
+#else
+        return Kernel{ InterleaveDefault, PermuteDefault, "default" };
+#endif
+    }();
+    return k;
+}
+
+void InterleaveRow(int dtsz, int c, const char *const *src, size_t n, char *dst, int stride) {
+    Pick().fn(dtsz, c, src, n, dst, stride);
+}
+
+void PermuteBlock(int dtsz, const size_t *dims, const char *src, const ptrdiff_t *sstride,
+    char *dst, const ptrdiff_t *dstride)
+{
+    Pick().permute(dtsz, dims, src, sstride, dst, dstride);
+}
+
+const char *TransposeKernelName() {
+    return Pick().name;
+}
@@ -0,0 +1,18 @@
+// Element level kernels for the transpose stage
+#pragma once
+#include <cstddef>
+
+// Interleaves c rows of n elements of size dtsz into dst, pixel by pixel
+// Output pixels are stride elements apart, at least c, so a subset of the bands can be placed
+// dtsz has to be 1, 2, 4, 8 or 16, the rows should be aligned to dtsz
+void InterleaveRow(int dtsz, int c, const char *const *src, size_t n, char *dst, int stride);
+
+// Copies a 3D block of dtsz sized elements between two strided layouts, for any axis order
+// dims and the byte strides are in destination order, innermost first
+// Rows are copied when both sides are contiguous, otherwise the two axes contiguous in the
+// source and in the destination are transposed in cache sized tiles
+void PermuteBlock(int dtsz, const size_t *dims, const char *src, const ptrdiff_t *sstride,
+    char *dst, const ptrdiff_t *dstride);
+
+// Name of the instruction set variant picked at runtime
+const char *TransposeKernelName();
@@ -0,0 +1,223 @@
+#include "view.h"
+#include <algorithm>
+#include <cstring>
+#include "options.h"
+#include "transpose.h"
+
+using namespace std;
+
+TransposedView::TransposedView() : psz(0), interleaved(false), budget(static_cast<size_t>(1) << 30), used(0),
+    hits(0), misses(0)
+{
+    for (int i = 0; i < 4; i++) {
+        axes[i] = i;
+        isz[i] = osz[i] = blk[i] = 0;
+        nb[i] = 0;
+    }
+}
+
+bool TransposedView::Open(const char *fname, const int ax[4], int ypsz) {
+    Close();
+    if (!ValidAxes(ax)) {
+        CPLError(CE_Failure, CPLE_IllegalArg, "The axes have to be a permutation of x, y, z and c");
+        return false;
+    }
+    if (!reader.Open(fname)) {
+        CPLError(CE_Failure, CPLE_OpenFailed, "Can't open %s as a 3D MRF", fname);
+        return false;
+    }
+    if (!reader.IsSupported() || !reader.IndexUsable()) {
+        CPLError(CE_Failure, CPLE_NotSupported, "Can't read the tiles of %s, %s", fname, reader.Reason());
+        reader.Close();
+        return false;
+    }
+
+    isz[0] = reader.xsz;
+    isz[1] = reader.ysz;
+    isz[2] = reader.zsz;
+    isz[3] = reader.csz;
+    copy(ax, ax + 4, axes);
+    for (int i = 0; i < 4; i++)
+        osz[i] = isz[axes[i]];
+    psz = ypsz > 0 ? ypsz : reader.pszy;
+    interleaved = reader.Interleaved() && osz[3] > 1;
+
+    // Same as the cublock unit, whole input and output pages, interleaved pages hold all the bands
+    for (int a = 0; a < 4; a++) {
+        int in = a == 0 ? reader.pszx : a == 1 ? reader.pszy : a == 3 && reader.Interleaved() ? isz[3] : 1;
+        int out = a == axes[0] ? reader.pszx : a == axes[1] ? psz : 1;
+        if (a == axes[3] && interleaved)
+            out = osz[3];
+        blk[a] = PageUnit(in, out, isz[a]);
+        nb[a] = (isz[a] + blk[a] - 1) / blk[a];
+    }
+    return true;
+}
+
+void TransposedView::Close() {
+    lock_guard<mutex> lock(mtx);
+    cache.clear();
+    lru.clear();
+    used = 0;
+    reader.Close();
+}
+
+void TransposedView::SetBudget(size_t bytes) {
+    lock_guard<mutex> lock(mtx);
+    budget = bytes;
+    Evict();
+}
+
+size_t TransposedView::CachedBytes() const {
+    lock_guard<mutex> lock(mtx);
+    return used;
+}
+
+size_t TransposedView::PageBytes() const {
+    return static_cast<size_t>(reader.pszx) * psz * (interleaved ? osz[3] : 1) * reader.dtsz;
+}
+
+// Blocks still in use by a reader are freed when it is done
+void TransposedView::Evict() {
+    while (used > budget && lru.size() > 1) {
+        auto it = cache.find(lru.back());
+        used -= it->second.data->size();
+        cache.erase(it);
+        lru.pop_back();
+    }
+}
+
+void TransposedView::Extents(const int b[4], int start[4], int ext[4]) const {
+    for (int a = 0; a < 4; a++) {
+        start[a] = b[a] * blk[a];
+        ext[a] = min(blk[a], isz[a] - start[a]);
+    }
+}
+
+// Reads the input tiles into a [c][z][y][x] buffer, then permutes each output slice,
+// the same strides as the cublocks of a full run
+bool TransposedView::Load(const int b[4], vector<char> &out) const {
+    int start[4], ext[4];
+    Extents(b, start, ext);
+    int dtsz = reader.dtsz;
+    GSpacing s[4];
+    s[0] = dtsz;
+    s[1] = ext[0] * s[0];
+    s[2] = ext[1] * s[1];
+    s[3] = ext[2] * s[2];
+    vector<char> in(static_cast<size_t>(s[3]) * ext[3]);
+    if (CE_None != reader.ReadBlock(start, ext, in.data(), s))
+        return false;
+
+    // Band separate output slices, innermost first
+    size_t dims[3] = { static_cast<size_t>(ext[axes[0]]), static_cast<size_t>(ext[axes[1]]),
+        static_cast<size_t>(ext[axes[3]]) };
+    ptrdiff_t sstride[3] = { s[axes[0]], s[axes[1]], s[axes[3]] };
+    ptrdiff_t dstride[3] = { dtsz, static_cast<ptrdiff_t>(dims[0]) * dtsz,
+        static_cast<ptrdiff_t>(dims[0] * dims[1]) * dtsz };
+    size_t oslice = dims[0] * dims[1] * dims[2] * dtsz;
+    out.resize(oslice * ext[axes[2]]);
+    for (int k = 0; k < ext[axes[2]]; k++)
+        PermuteBlock(dtsz, dims, in.data() + k * s[axes[2]], sstride, out.data() + k * oslice, dstride);
+    return true;
+}
+
+TransposedView::Data TransposedView::Get(const int pos[4]) {
+    int b[4];
+    for (int a = 0; a < 4; a++)
+        b[a] = pos[a] / blk[a];
+    uint64_t key = ((b[3] * nb[2] + b[2]) * nb[1] + b[1]) * nb[0] + b[0];
+
+    unique_lock<mutex> lock(mtx);
+    for (;;) {
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            hits++;
+            lru.splice(lru.begin(), lru, it->second.lru);
+            return it->second.data;
+        }
+        // Another thread is reading it
+        if (!loading.count(key))
+            break;
+        loaded.wait(lock);
+    }
+    loading.insert(key);
+    misses++;
+    lock.unlock();
+
+    shared_ptr<vector<char>> data = make_shared<vector<char>>();
+    bool ok = Load(b, *data);
+
+    lock.lock();
+    loading.erase(key);
+    if (ok) {
+        lru.push_front(key);
+        Entry e = { data, lru.begin() };
+        cache[key] = e;
+        used += data->size();
+        Evict();
+    }
+    loaded.notify_all();
+    return ok ? data : Data();
+}
+
+CPLErr TransposedView::Read(int z, int c, int x0, int y0, int w, int h, void *buf, GSpacing pix, GSpacing line) {
+    if (z < 0 || z >= osz[2] || c < 0 || c >= osz[3] || x0 < 0 || y0 < 0 || w <= 0 || h <= 0
+        || x0 + w > osz[0] || y0 + h > osz[1])
+    {
+        CPLError(CE_Failure, CPLE_IllegalArg, "Region %d,%d %dx%d of slice %d band %d is outside of the view",
+            x0, y0, w, h, z, c);
+        return CE_Failure;
+    }
+
+    int ax = axes[0], ay = axes[1], az = axes[2], ac = axes[3];
+    int dtsz = reader.dtsz;
+    char *dst = static_cast<char *>(buf);
+    int pos[4];
+    pos[az] = z;
+    pos[ac] = c;
+    // One block at a time, each one is held only while copying from it
+    for (int by = y0; by < y0 + h; by = (by / blk[ay] + 1) * blk[ay]) {
+        for (int bx = x0; bx < x0 + w; bx = (bx / blk[ax] + 1) * blk[ax]) {
+            pos[ax] = bx;
+            pos[ay] = by;
+            Data d = Get(pos);
+            if (!d)
+                return CE_Failure;
+            int b[4], start[4], ext[4];
+            for (int a = 0; a < 4; a++)
+                b[a] = pos[a] / blk[a];
+            Extents(b, start, ext);
+            int y1 = min(y0 + h, start[ay] + ext[ay]);
+            int n = min(x0 + w, start[ax] + ext[ax]) - bx;
+            size_t plane = static_cast<size_t>(z - start[az]) * ext[ac] + (c - start[ac]);
+            for (int y = by; y < y1; y++) {
+                const char *src = d->data()
+                    + ((plane * ext[ay] + (y - start[ay])) * ext[ax] + (bx - start[ax])) * dtsz;
+                GDALCopyWords64(src, reader.dt, dtsz, dst + (y - y0) * line + (bx - x0) * pix, reader.dt,
+                    static_cast<int>(pix), n);
+            }
+        }
+    }
+    return CE_None;
+}
+
+CPLErr TransposedView::ReadTile(int tx, int ty, int z, int tc, void *page) {
+    int pszx = reader.pszx, dtsz = reader.dtsz;
+    int x0 = tx * pszx, y0 = ty * psz;
+    if (tx < 0 || ty < 0 || x0 >= osz[0] || y0 >= osz[1]) {
+        CPLError(CE_Failure, CPLE_IllegalArg, "Tile %d,%d is outside of the view", tx, ty);
+        return CE_Failure;
+    }
+    memset(page, 0, PageBytes());
+    int w = min(pszx, osz[0] - x0), h = min(psz, osz[1] - y0);
+    char *p = static_cast<char *>(page);
+    if (!interleaved)
+        return Read(z, tc, x0, y0, w, h, p, dtsz, static_cast<GSpacing>(pszx) * dtsz);
+    int nbands = osz[3];
+    for (int c = 0; c < nbands; c++)
+        if (CE_None != Read(z, c, x0, y0, w, h, p + c * dtsz, static_cast<GSpacing>(nbands) * dtsz,
+            static_cast<GSpacing>(pszx) * nbands * dtsz))
+            return CE_Failure;
+    return CE_None;
+}
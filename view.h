@@ -0,0 +1,91 @@
+// A transposed 3D MRF that is never written, the output tiles are transposed when asked for
+// A request reads the input tiles of the block that holds it, whole input and output pages, the same
+// as a cublock, transposes the block and keeps it in a cache with a byte budget
+// The least recently used blocks are dropped first. Safe to share between threads
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <gdal.h>
+#include "mrf_reader.h"
+
+class TransposedView {
+public:
+    TransposedView();
+
+    // Opens an input 3D MRF, axes are the input x, y, z and c axes that become the output ones,
+    // numbered 0 to 3, same as --axes. psz is the output y page size, 0 for the input one
+    // False if the input tiles can't be read directly
+    bool Open(const char *fname, const int axes[4], int psz = 0);
+    void Close();
+
+    // Cache size in bytes, the default is 1 GiB, the block in use is always kept
+    void SetBudget(size_t bytes);
+    // Value for empty input tiles
+    void SetFill(double v) { reader.SetFill(v); }
+
+    // Output size as x, y, slices and bands
+    int Size(int i) const { return osz[i]; }
+    int PageX() const { return reader.pszx; }
+    int PageY() const { return psz; }
+    GDALDataType DataType() const { return reader.dt; }
+    // Output pages hold all the bands
+    bool Interleaved() const { return interleaved; }
+    const MRFReader &Input() const { return reader; }
+
+    // Reads a w by h region of band c of output slice z, strides in bytes
+    CPLErr Read(int z, int c, int x0, int y0, int w, int h, void *buf, GSpacing pix, GSpacing line);
+    // Reads an output tile, packed as an output MRF page, tc is 0 when interleaved
+    // Past the edge of the raster, the page is zero
+    CPLErr ReadTile(int tx, int ty, int z, int tc, void *page);
+
+    size_t PageBytes() const;
+    // Block size along each input axis
+    int BlockSize(int axis) const { return blk[axis]; }
+
+    uint64_t Hits() const { return hits; }
+    uint64_t Misses() const { return misses; }
+    size_t CachedBytes() const;
+
+private:
+    TransposedView(const TransposedView &) = delete;
+    TransposedView &operator=(const TransposedView &) = delete;
+
+    // A transposed block, as [slice][band][y][x] of the output
+    typedef std::shared_ptr<const std::vector<char>> Data;
+
+    // The block holding an input position, loaded if needed, empty on failure
+    Data Get(const int pos[4]);
+    // Reads and transposes the block at these block numbers
+    bool Load(const int b[4], std::vector<char> &out) const;
+    void Extents(const int b[4], int start[4], int ext[4]) const;
+    // Drops the least recently used blocks until under budget, with the lock held
+    void Evict();
+
+    MRFReader reader;
+    int axes[4];
+    int isz[4];                 // Input size, x, y, z and c
+    int osz[4];
+    int psz;
+    bool interleaved;
+    int blk[4];                 // Block size along the input axes
+    uint64_t nb[4];             // Blocks along the input axes
+
+    struct Entry {
+        Data data;
+        std::list<uint64_t>::iterator lru;
+    };
+    mutable std::mutex mtx;
+    std::condition_variable loaded;
+    std::unordered_map<uint64_t, Entry> cache;
+    std::list<uint64_t> lru;    // Most recent first
+    std::set<uint64_t> loading; // Read by one thread, the others wait
+    size_t budget, used;
+    std::atomic<uint64_t> hits, misses;
+};